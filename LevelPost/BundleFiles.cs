@@ -1,153 +1,344 @@
 ﻿using System;
+using System.Collections.Concurrent;
 using System.Collections.Generic;
 using System.ComponentModel;
 using System.Diagnostics;
 using System.IO;
 using System.Linq;
-using System.Runtime.InteropServices;
+using System.Threading;
+using System.Threading.Tasks;
 using rdbundle;
 
 namespace LevelPost
 {
-    [StructLayout(LayoutKind.Sequential, CharSet = CharSet.Auto)]
-    struct WIN32_FIND_DATA
+    class BundleInfo
     {
-        public uint dwFileAttributes;
-        public System.Runtime.InteropServices.ComTypes.FILETIME ftCreationTime;
-        public System.Runtime.InteropServices.ComTypes.FILETIME ftLastAccessTime;
-        public System.Runtime.InteropServices.ComTypes.FILETIME ftLastWriteTime;
-        public uint nFileSizeHigh;
-        public uint nFileSizeLow;
-        public uint dwReserved0;
-        public uint dwReserved1;
-        [MarshalAs(UnmanagedType.ByValTStr, SizeConst = 260)]
-        public string cFileName;
-        [MarshalAs(UnmanagedType.ByValTStr, SizeConst = 14)]
-        public string cAlternateFileName;
+        public string path;
+        public UInt64 lastWriteTime;
+        public long size;
+        public Guid guid;
+        public Dictionary<string, string> materials;
+        public HashSet<string> gameObjects;
     }
 
-    [StructLayout(LayoutKind.Sequential)]
-    struct WIN32_FILE_ATTRIBUTE_DATA
-    {
-        public uint dwFileAttributes;
-        public System.Runtime.InteropServices.ComTypes.FILETIME ftCreationTime;
-        public System.Runtime.InteropServices.ComTypes.FILETIME ftLastAccessTime;
-        public System.Runtime.InteropServices.ComTypes.FILETIME ftLastWriteTime;
-        public uint nFileSizeHigh;
-        public uint nFileSizeLow;
-    }
-    
-    enum GET_FILEEX_INFO_LEVELS
+    class BundleResult
     {
-        GetFileExInfoStandard,
-        GetFileExMaxInfoLevel
+        public string path;
+        public BundleInfo info;
+        public Exception error;
     }
-    static class FileTimeExt
+
+    class BundleFiles
     {
-        public static UInt64 ToUInt64(this System.Runtime.InteropServices.ComTypes.FILETIME ft)
+
+        public ConcurrentDictionary<string, BundleInfo> Bundles = new ConcurrentDictionary<string, BundleInfo>();
+        public Action<string> Logger;
+
+        private const uint IndexMagic = 0x4942504c; // LPBI
+        private const int IndexVersion = 1;
+        private int indexChanges; // bumped after every bundle info update
+        private int savedChanges; // indexChanges when the index was last saved
+
+        public static string DefaultIndexPath
         {
-            return (uint)ft.dwLowDateTime | ((ulong)(uint)ft.dwHighDateTime << 32);
+            get
+            {
+                return Path.Combine(Environment.GetFolderPath(Environment.SpecialFolder.LocalApplicationData),
+                    "LevelPost", "bundles.idx");
+            }
         }
-    }
 
-    static class DirScan
-    {
-        public const int ERROR_NO_MORE_FILES = 18;
-        public const int FILE_ATTRIBUTE_DIRECTORY = 0x10;
-        [DllImport("kernel32", CharSet = CharSet.Auto, SetLastError = true)]
-        public static extern IntPtr FindFirstFile(string lpFileName, out WIN32_FIND_DATA lpFindFileData);
-        [DllImport("kernel32", CharSet = CharSet.Auto, SetLastError = true)]
-        public static extern bool FindNextFile(IntPtr hFindFile, out WIN32_FIND_DATA lpFindFileData);
-        [DllImport("kernel32", CharSet = CharSet.Auto, SetLastError = true)]
-        public static extern bool FindClose(IntPtr hFindFile);
-        [DllImport("kernel32.dll", SetLastError = true, CharSet = CharSet.Unicode)]
-        public static extern bool GetFileAttributesEx(string lpFileName,
-          GET_FILEEX_INFO_LEVELS fInfoLevelId, out WIN32_FILE_ATTRIBUTE_DATA fileData);
-
-        public static IEnumerable<WIN32_FIND_DATA> DirScanner(string path)
+        private static bool IsBundleCandidate(FileInfo f)
         {
-            WIN32_FIND_DATA data;
-            var hnd = FindFirstFile(path + @"\*", out data);
-            if (hnd == (IntPtr)(-1))
-                throw new Exception(path + ": " + new Win32Exception().Message);
-            for (;;)
+            return !f.Name.Contains('.') && f.Length >= 1024;
+        }
+
+        // Scans baseDir for bundles. Directories are enumerated in parallel and the found
+        // files are read by a pool of workers, errors are logged and skip the file or directory.
+        // progress is called with the number of files read and found so far.
+        public void ScanBundles(string baseDir, Action<int, int> progress = null,
+            CancellationToken cancel = default(CancellationToken))
+        {
+            var files = new BlockingCollection<FileInfo>(256);
+            int found = 0, done = 0;
+            var span = Tracer.Begin("scan bundles", 0, baseDir);
+            var workers = Enumerable.Range(0, Environment.ProcessorCount).Select(_ => Task.Factory.StartNew(() => {
+                foreach (var f in files.GetConsumingEnumerable(cancel))
+                {
+                    try
+                    {
+                        CachedBundleInfo(f.FullName, (UInt64)f.LastWriteTimeUtc.ToFileTimeUtc(), f.Length);
+                    }
+                    catch (Exception ex)
+                    {
+                        Logger("Error: cannot read bundle file: " + f.FullName + ": " + ex.Message);
+                    }
+                    progress?.Invoke(Interlocked.Increment(ref done), Volatile.Read(ref found));
+                }
+            }, cancel, TaskCreationOptions.LongRunning, TaskScheduler.Default)).ToArray();
+
+            var opts = new ParallelOptions() { CancellationToken = cancel };
+            Action<DirectoryInfo> walk = null;
+            walk = dir => {
+                // only the windows bundles are used
+                bool skipFiles = dir.Name.Equals("linux", StringComparison.OrdinalIgnoreCase) ||
+                    dir.Name.Equals("osx", StringComparison.OrdinalIgnoreCase);
+                var subDirs = new List<DirectoryInfo>();
+                try
+                {
+                    foreach (var entry in dir.EnumerateFileSystemInfos())
+                    {
+                        cancel.ThrowIfCancellationRequested();
+                        if (entry is DirectoryInfo subDir)
+                            subDirs.Add(subDir);
+                        else if (!skipFiles && IsBundleCandidate((FileInfo)entry))
+                        {
+                            Interlocked.Increment(ref found);
+                            files.Add((FileInfo)entry, cancel);
+                        }
+                    }
+                }
+                catch (Exception ex) when (ex is IOException || ex is UnauthorizedAccessException)
+                {
+                    Logger("Error: cannot read bundle directory: " + dir.FullName + ": " + ex.Message);
+                    return;
+                }
+                Parallel.ForEach(subDirs, opts, walk);
+            };
+
+            try
             {
-                yield return data;
-                if (!FindNextFile(hnd, out data)) {
-                    if (Marshal.GetLastWin32Error() == ERROR_NO_MORE_FILES)
-                        yield break;
-                    throw new Win32Exception(path);
+                walk(new DirectoryInfo(baseDir));
+            }
+            catch (Exception) when (cancel.IsCancellationRequested)
+            {
+            }
+            finally
+            {
+                files.CompleteAdding();
+                try
+                {
+                    Task.WaitAll(workers);
+                }
+                catch (AggregateException) when (cancel.IsCancellationRequested)
+                {
                 }
+                span.Dispose();
             }
+            cancel.ThrowIfCancellationRequested();
         }
-    }
-
-    class BundleInfo
-    {
-        public string path;
-        public UInt64 lastWriteTime;
-        public Dictionary<string, string> materials;
-        public HashSet<string> gameObjects;
-    }
-
-    class BundleFiles
-    {
 
-        public Dictionary<string, BundleInfo> Bundles = new Dictionary<string, BundleInfo>();
-        public Action<string> Logger;
+        // Reads the given bundle files in parallel, the results are in the order of paths.
+        public BundleResult[] ReadBundles(IList<string> paths, Action<int, int> progress = null,
+            CancellationToken cancel = default(CancellationToken))
+        {
+            var results = new BundleResult[paths.Count];
+            int done = 0;
+            var span = Tracer.Begin("read bundles");
+            var opts = new ParallelOptions() { CancellationToken = cancel };
+            Parallel.For(0, paths.Count, opts, i => {
+                var result = new BundleResult() { path = paths[i] };
+                try
+                {
+                    result.info = CachedBundleInfo(paths[i]);
+                }
+                catch (Exception ex)
+                {
+                    result.error = ex;
+                }
+                results[i] = result;
+                progress?.Invoke(Interlocked.Increment(ref done), paths.Count);
+            });
+            span.Dispose();
+            return results;
+        }
 
-        public void ScanBundles(string baseDir)
+        public BundleInfo CachedBundleInfo(string path, UInt64 lastWriteTime = 0, long size = -1)
         {
-            var dirs = new Stack<string>();
-            dirs.Push(baseDir);
-            while (dirs.Any())
+            if (lastWriteTime == 0)
             {
-                string dir = dirs.Pop();
-                foreach (var f in DirScan.DirScanner(dir))
+                var fi = new FileInfo(path);
+                if (!fi.Exists)
+                    throw new Exception(path + ": " + new Win32Exception(2).Message); // ERROR_FILE_NOT_FOUND
+                lastWriteTime = (UInt64)fi.LastWriteTimeUtc.ToFileTimeUtc();
+                size = fi.Length;
+            }
+            var info = Bundles.GetOrAdd(path.ToUpperInvariant(), _ => new BundleInfo() { path = path });
+            // Logger may wait for the UI thread, which can be waiting for this lock,
+            // so warnings are logged after it is released
+            List<string> warnings = null;
+            try
+            {
+                // one reader per bundle, others wait for its result
+                lock (info)
                 {
-                    string filename = f.cFileName;
-                    string path = Path.Combine(dir, filename);
-                    if ((f.dwFileAttributes & DirScan.FILE_ATTRIBUTE_DIRECTORY) != 0)
+                    if (info.lastWriteTime == lastWriteTime && info.size == size && info.materials != null)
+                        return info;
+
+                    // same content under a new timestamp or path, only the header needs reading
+                    Guid guid;
+                    using (Tracer.Begin("read bundle header", 0, path))
+                        guid = BundleFile.ReadBundleGuid(path);
+                    if (guid != Guid.Empty)
                     {
-                        if (filename != "." && filename != "..")
-                            dirs.Push(path);
-                        continue;
+                        var same = FindSameBundle(info, guid, size);
+                        if (same != null)
+                        {
+                            info.materials = same.materials;
+                            info.gameObjects = same.gameObjects;
+                            info.guid = guid;
+                            info.lastWriteTime = lastWriteTime;
+                            info.size = size;
+                            Interlocked.Increment(ref indexChanges);
+                            return info;
+                        }
                     }
-                    if (dir.EndsWith(@"\linux") || dir.EndsWith(@"\osx"))
-                        continue;
-                    if (filename.Contains('.') || (f.nFileSizeHigh == 0 && f.nFileSizeLow < 1024))
-                        continue;
-                    CachedBundleInfo(path, f.ftLastWriteTime.ToUInt64());
+
+                    List<string> materials, gameObjects;
+                    using (Tracer.Begin("read bundle", size, path))
+                        BundleFile.ReadBundleFile(path, out materials, out gameObjects);
+                    var mats = new Dictionary<string,string>(StringComparer.OrdinalIgnoreCase);
+                    foreach (var material in materials)
+                        if (mats.ContainsKey(material.ToLowerInvariant()))
+                            (warnings ?? (warnings = new List<string>())).Add("WARNING: Bundle " + path + " contains multiple versions of " + material);
+                        else
+                            mats.Add(material.ToLowerInvariant(), material);
+                    var gos = new HashSet<string>(StringComparer.OrdinalIgnoreCase);
+                    foreach (var gameObject in gameObjects)
+                        if (gameObject.StartsWith("entity_", StringComparison.OrdinalIgnoreCase))
+                            gos.Add(gameObject);
+                    info.materials = mats;
+                    info.gameObjects = gos;
+                    info.guid = guid;
+                    info.lastWriteTime = lastWriteTime;
+                    info.size = size;
+                    Interlocked.Increment(ref indexChanges);
+                    return info;
                 }
             }
+            finally
+            {
+                if (warnings != null)
+                    foreach (var msg in warnings)
+                        Logger(msg);
+            }
         }
 
-        public BundleInfo CachedBundleInfo(string path, UInt64 lastWriteTime = 0)
+        // Copy of another entry with the same header guid and size that was read already.
+        // Its fields are read under its lock. Called with info locked, so an entry that
+        // is locked by another reader is skipped instead of waited for (lock order).
+        private BundleInfo FindSameBundle(BundleInfo info, Guid guid, long size)
         {
-            if (lastWriteTime == 0)
+            foreach (var x in Bundles.Values)
             {
+                if (x == info || !Monitor.TryEnter(x))
+                    continue;
+                try
+                {
+                    if (x.guid == guid && x.size == size && x.materials != null)
+                        return new BundleInfo() { path = x.path, lastWriteTime = x.lastWriteTime, size = x.size, guid = x.guid,
+                            materials = x.materials, gameObjects = x.gameObjects };
+                }
+                finally
+                {
+                    Monitor.Exit(x);
+                }
+            }
+            return null;
+        }
 
-                if (!DirScan.GetFileAttributesEx(path, GET_FILEEX_INFO_LEVELS.GetFileExInfoStandard, out WIN32_FILE_ATTRIBUTE_DATA fa))
-                    throw new Exception(path + ": " + new Win32Exception().Message);
-                lastWriteTime = fa.ftLastWriteTime.ToUInt64();
+        // Index file: magic, version, entry count, then per bundle the path, size,
+        // last write time, header guid, material names and entity names.
+        // Entries are only used when size and time still match the file.
+        public void LoadIndex(string indexPath)
+        {
+            if (!File.Exists(indexPath))
+                return;
+            try
+            {
+                var loaded = new List<BundleInfo>();
+                using (var r = new BinaryReader(new BufferedStream(File.OpenRead(indexPath), 0x10000)))
+                {
+                    if (r.ReadUInt32() != IndexMagic || r.ReadInt32() != IndexVersion)
+                        return;
+                    for (int n = r.ReadInt32(); n > 0; n--)
+                    {
+                        var info = new BundleInfo()
+                        {
+                            path = r.ReadString(),
+                            size = r.ReadInt64(),
+                            lastWriteTime = r.ReadUInt64(),
+                            guid = new Guid(r.ReadBytes(16)),
+                            materials = new Dictionary<string, string>(StringComparer.OrdinalIgnoreCase),
+                            gameObjects = new HashSet<string>(StringComparer.OrdinalIgnoreCase)
+                        };
+                        for (int i = r.ReadInt32(); i > 0; i--)
+                        {
+                            var material = r.ReadString();
+                            info.materials[material.ToLowerInvariant()] = material;
+                        }
+                        for (int i = r.ReadInt32(); i > 0; i--)
+                            info.gameObjects.Add(r.ReadString());
+                        loaded.Add(info);
+                    }
+                }
+                foreach (var info in loaded)
+                    Bundles.TryAdd(info.path.ToUpperInvariant(), info);
+            }
+            catch (Exception ex)
+            {
+                Logger("Ignoring bundle index " + indexPath + ": " + ex.Message);
             }
-            if (!Bundles.TryGetValue(path.ToUpperInvariant(), out BundleInfo info))
-                Bundles.Add(path.ToUpperInvariant(), info = new BundleInfo() { path = path });
-            else if (info.lastWriteTime == lastWriteTime)
-                return info;
-            info.lastWriteTime = lastWriteTime;
-            BundleFile.ReadBundleFile(path, out List<string> materials, out List<string> gameObjects);
-            info.materials = new Dictionary<string,string>(StringComparer.OrdinalIgnoreCase);
-            foreach (var material in materials)
-                if (info.materials.ContainsKey(material.ToLowerInvariant()))
-                    Logger("WARNING: Bundle " + path + " contains multiple versions of " + material);
+        }
+
+        // Writes the index if anything was read since the last load or save,
+        // entries of bundles that no longer exist are dropped.
+        public void SaveIndex(string indexPath)
+        {
+            // updates finishing after this are saved the next time
+            int changes = Volatile.Read(ref indexChanges);
+            if (changes == savedChanges)
+                return;
+            var infos = new List<BundleInfo>();
+            foreach (var info in Bundles.Values)
+                lock (info)
+                    if (info.materials != null)
+                        infos.Add(new BundleInfo() { path = info.path, size = info.size, lastWriteTime = info.lastWriteTime,
+                            guid = info.guid, materials = info.materials, gameObjects = info.gameObjects });
+            string tmpPath = indexPath + ".tmp";
+            try
+            {
+                Directory.CreateDirectory(Path.GetDirectoryName(indexPath));
+                using (var w = new BinaryWriter(new BufferedStream(File.Create(tmpPath), 0x10000)))
+                {
+                    var live = infos.Where(x => File.Exists(x.path)).ToArray();
+                    w.Write(IndexMagic);
+                    w.Write(IndexVersion);
+                    w.Write(live.Length);
+                    foreach (var info in live)
+                    {
+                        w.Write(info.path);
+                        w.Write(info.size);
+                        w.Write(info.lastWriteTime);
+                        w.Write(info.guid.ToByteArray());
+                        w.Write(info.materials.Count);
+                        foreach (var material in info.materials.Values)
+                            w.Write(material);
+                        w.Write(info.gameObjects.Count);
+                        foreach (var gameObject in info.gameObjects)
+                            w.Write(gameObject);
+                    }
+                }
+                if (File.Exists(indexPath))
+                    File.Replace(tmpPath, indexPath, null);
                 else
-                    info.materials.Add(material.ToLowerInvariant(), material);
-            info.gameObjects = new HashSet<string>(StringComparer.OrdinalIgnoreCase);
-            foreach (var gameObject in gameObjects)
-                if (gameObject.StartsWith("entity_", StringComparison.OrdinalIgnoreCase))
-                    info.gameObjects.Add(gameObject);
-            return info;
+                    File.Move(tmpPath, indexPath);
+                savedChanges = changes;
+            }
+            catch (Exception ex)
+            {
+                Logger("Cannot save bundle index " + indexPath + ": " + ex.Message);
+            }
         }
     }
 }
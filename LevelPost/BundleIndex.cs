@@ -0,0 +1,262 @@
+﻿using System;
+using System.Collections.Generic;
+
+namespace LevelPost
+{
+    // Immutable case insensitive index of the material and entity names of a list of bundles.
+    // A name maps to every bundle containing it in list order, the first one is used for the
+    // conversion and the others are reported as conflicts. Update derives the index of a new
+    // bundle list from the previous one, only re-adding the names of the bundles whose contents
+    // were replaced by BundleFiles.CachedBundleInfo.
+    class BundleIndex
+    {
+        public struct Hit
+        {
+            public int bundle; // index in Bundles
+            public string name; // spelling in that bundle
+        }
+
+        // Open addressing with linear probing. Only changed while building an index, a table
+        // is shared by the indexes derived from it without changes.
+        private class NameTable
+        {
+            private static readonly Hit[] Removed = new Hit[0];
+            private string[] keys; // null for an empty slot
+            private int[] hashes;
+            private Hit[][] hits; // Removed for a deleted slot
+            private int used; // non empty slots, including deleted ones
+            private int count;
+
+            public NameTable(int names)
+            {
+                int capacity = 16;
+                while (capacity * 7 / 10 < names)
+                    capacity *= 2;
+                keys = new string[capacity];
+                hashes = new int[capacity];
+                hits = new Hit[capacity][];
+            }
+
+            public NameTable Clone()
+            {
+                var table = (NameTable)MemberwiseClone();
+                table.keys = (string[])keys.Clone();
+                table.hashes = (int[])hashes.Clone();
+                table.hits = (Hit[][])hits.Clone();
+                return table;
+            }
+
+            private static int Hash(string name)
+            {
+                return StringComparer.OrdinalIgnoreCase.GetHashCode(name);
+            }
+
+            private int Find(string name, int hash)
+            {
+                int mask = keys.Length - 1;
+                for (int i = hash & mask; keys[i] != null; i = (i + 1) & mask)
+                    if (hashes[i] == hash && hits[i] != Removed && string.Equals(keys[i], name, StringComparison.OrdinalIgnoreCase))
+                        return i;
+                return -1;
+            }
+
+            public Hit[] Get(string name)
+            {
+                int i = Find(name, Hash(name));
+                return i < 0 ? null : hits[i];
+            }
+
+            public void Add(string key, int bundle, string name)
+            {
+                int hash = Hash(key), i = Find(key, hash);
+                var hit = new Hit() { bundle = bundle, name = name };
+                if (i >= 0)
+                {
+                    // hit arrays are shared with cloned tables, so replace instead of change
+                    var old = hits[i];
+                    int pos = 0;
+                    while (pos < old.Length && old[pos].bundle < bundle)
+                        pos++;
+                    if (pos < old.Length && old[pos].bundle == bundle)
+                        return;
+                    var list = new Hit[old.Length + 1];
+                    Array.Copy(old, list, pos);
+                    list[pos] = hit;
+                    Array.Copy(old, pos, list, pos + 1, old.Length - pos);
+                    hits[i] = list;
+                    return;
+                }
+                if ((used + 1) * 10 > keys.Length * 7)
+                    Resize();
+                int mask = keys.Length - 1;
+                for (i = hash & mask; keys[i] != null && hits[i] != Removed; i = (i + 1) & mask)
+                    ;
+                if (keys[i] == null)
+                    used++;
+                keys[i] = key;
+                hashes[i] = hash;
+                hits[i] = new[] { hit };
+                count++;
+            }
+
+            public void Remove(string key, int bundle)
+            {
+                int i = Find(key, Hash(key));
+                if (i < 0)
+                    return;
+                var old = hits[i];
+                int pos = Array.FindIndex(old, x => x.bundle == bundle);
+                if (pos < 0)
+                    return;
+                if (old.Length == 1)
+                {
+                    hits[i] = Removed;
+                    count--;
+                    return;
+                }
+                var list = new Hit[old.Length - 1];
+                Array.Copy(old, list, pos);
+                Array.Copy(old, pos + 1, list, pos, list.Length - pos);
+                hits[i] = list;
+            }
+
+            // rehash the live slots, dropping the deleted ones
+            private void Resize()
+            {
+                var table = new NameTable(count * 2 + 1);
+                for (int i = 0; i < keys.Length; i++)
+                    if (keys[i] != null && hits[i] != Removed)
+                    {
+                        int mask = table.keys.Length - 1, j = hashes[i] & mask;
+                        while (table.keys[j] != null)
+                            j = (j + 1) & mask;
+                        table.keys[j] = keys[i];
+                        table.hashes[j] = hashes[i];
+                        table.hits[j] = hits[i];
+                    }
+                keys = table.keys;
+                hashes = table.hashes;
+                hits = table.hits;
+                used = count;
+            }
+
+            public IEnumerable<Hit[]> Conflicts()
+            {
+                for (int i = 0; i < keys.Length; i++)
+                    if (keys[i] != null && hits[i].Length > 1)
+                        yield return hits[i];
+            }
+        }
+
+        public readonly IList<ConvertBundle> Bundles;
+        private readonly NameTable materials, entities;
+
+        private BundleIndex(IList<ConvertBundle> bundles, NameTable materials, NameTable entities)
+        {
+            Bundles = bundles;
+            this.materials = materials;
+            this.entities = entities;
+        }
+
+        private static void AddBundle(NameTable materials, NameTable entities, int i, ConvertBundle bun)
+        {
+            if (bun.Materials != null)
+                foreach (var mat in bun.Materials)
+                    materials.Add(mat.Key, i, mat.Value);
+            if (bun.GameObjects != null)
+                foreach (var go in bun.GameObjects)
+                    entities.Add(go, i, go);
+        }
+
+        private static void RemoveBundle(NameTable materials, NameTable entities, int i, ConvertBundle bun)
+        {
+            if (bun.Materials != null)
+                foreach (var mat in bun.Materials.Keys)
+                    materials.Remove(mat, i);
+            if (bun.GameObjects != null)
+                foreach (var go in bun.GameObjects)
+                    entities.Remove(go, i);
+        }
+
+        public static BundleIndex Build(IList<ConvertBundle> bundles)
+        {
+            int numMats = 0, numGOs = 0;
+            foreach (var bun in bundles)
+            {
+                numMats += bun.Materials?.Count ?? 0;
+                numGOs += bun.GameObjects?.Count ?? 0;
+            }
+            var materials = new NameTable(numMats);
+            var entities = new NameTable(numGOs);
+            for (int i = 0; i < bundles.Count; i++)
+                AddBundle(materials, entities, i, bundles[i]);
+            return new BundleIndex(bundles, materials, entities);
+        }
+
+        // Index of bundles from previous, which may be null. Bundles at the same position with
+        // the same material and entity sets keep their names, the others are removed and added.
+        public static BundleIndex Update(BundleIndex previous, IList<ConvertBundle> bundles)
+        {
+            if (previous == null || previous.Bundles.Count != bundles.Count)
+                return Build(bundles);
+            var changed = new List<int>();
+            for (int i = 0; i < bundles.Count; i++)
+                if (previous.Bundles[i].Materials != bundles[i].Materials ||
+                    previous.Bundles[i].GameObjects != bundles[i].GameObjects)
+                    changed.Add(i);
+            if (changed.Count == 0)
+                return new BundleIndex(bundles, previous.materials, previous.entities);
+            if (changed.Count * 2 > bundles.Count)
+                return Build(bundles);
+            var materials = previous.materials.Clone();
+            var entities = previous.entities.Clone();
+            foreach (int i in changed)
+            {
+                RemoveBundle(materials, entities, i, previous.Bundles[i]);
+                AddBundle(materials, entities, i, bundles[i]);
+            }
+            return new BundleIndex(bundles, materials, entities);
+        }
+
+        public bool TryGetMaterial(string name, out string newName, out ConvertBundle bundle)
+        {
+            var hits = materials.Get(name);
+            if (hits == null)
+            {
+                newName = null;
+                bundle = null;
+                return false;
+            }
+            newName = hits[0].name;
+            bundle = Bundles[hits[0].bundle];
+            return true;
+        }
+
+        public bool TryGetGameObject(string name, out ConvertBundle bundle)
+        {
+            var hits = entities.Get(name);
+            bundle = hits == null ? null : Bundles[hits[0].bundle];
+            return hits != null;
+        }
+
+        private List<KeyValuePair<string, List<ConvertBundle>>> Conflicts(NameTable table)
+        {
+            var ret = new List<KeyValuePair<string, List<ConvertBundle>>>();
+            foreach (var hits in table.Conflicts())
+                ret.Add(new KeyValuePair<string, List<ConvertBundle>>(hits[0].name,
+                    new List<ConvertBundle>(Array.ConvertAll(hits, x => Bundles[x.bundle]))));
+            return ret;
+        }
+
+        // Names in more than one bundle with those bundles in list order
+        public List<KeyValuePair<string, List<ConvertBundle>>> MaterialConflicts()
+        {
+            return Conflicts(materials);
+        }
+
+        public List<KeyValuePair<string, List<ConvertBundle>>> EntityConflicts()
+        {
+            return Conflicts(entities);
+        }
+    }
+}
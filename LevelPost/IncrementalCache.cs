@@ -0,0 +1,252 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Reflection;
+using System.Security.Cryptography;
+using System.Text;
+#if TWEAKS
+using System.Text.RegularExpressions;
+#endif
+
+namespace LevelPost
+{
+    // What the last conversion of a level generated, kept in memory and in a
+    // sidecar file. The mods only look at commands of their InitTypes and
+    // CommandTypes, so if a new save of the level has the same commands of those
+    // types (and the same settings and texture files), the conversion gives the
+    // same result and the generated commands can be spliced in again without
+    // running the mods or loading any texture.
+    class IncrementalCache
+    {
+        public static long MemoryLimit = 256 << 20;
+
+        public static string DefaultDir
+        {
+            get
+            {
+                return Path.Combine(Environment.GetFolderPath(Environment.SpecialFolder.LocalApplicationData),
+                    "LevelPost", "levels");
+            }
+        }
+
+        private const uint FileMagic = 0x434e494c; // LINC
+        private const int FileVersion = 1;
+
+        public string levelFilename;
+        public string settingsKey;
+        public int version;
+        public VT[] types; // types of the commands the mods look at
+        public ulong[] hashes; // Hash of each command of these types, in file order
+        public bool[] handled; // command was replaced instead of copied
+        public byte[][] generated; // commands written before it, null if none
+        public byte[] final; // commands from Finish and CmdDone
+        public bool changed;
+        public ConvertStats stats;
+        public List<string> messages;
+
+        private static IncrementalCache last;
+
+        // 64-bit FNV-1a over 8 byte words with an extra shift, each step is a
+        // bijection so a single changed word always changes the hash
+        public static ulong Hash(byte[] data, int ofs, int n)
+        {
+            const ulong prime = 1099511628211;
+            ulong h = 14695981039346656037 ^ (ulong)n;
+            int end = ofs + n;
+            for (; ofs + 8 <= end; ofs += 8)
+            {
+                h = (h ^ BitConverter.ToUInt64(data, ofs)) * prime;
+                h ^= h >> 29;
+            }
+            for (; ofs < end; ofs++)
+                h = (h ^ data[ofs]) * prime;
+            return h;
+        }
+
+        // Everything besides the level that the conversion result depends on
+        public static string SettingsKey(string levelFilename, ConvertSettings settings)
+        {
+            var sb = new StringBuilder();
+            sb.AppendLine(typeof(IncrementalCache).Assembly.ManifestModule.ModuleVersionId.ToString());
+            foreach (var dir in settings.texDirs.Concat(new[] { "" }).Concat(settings.ignoreTexDirs))
+            {
+                sb.AppendLine(dir);
+                if (dir.Length != 0 && Directory.Exists(dir))
+                    foreach (var file in new DirectoryInfo(dir).EnumerateFiles("*.png").OrderBy(x => x.Name, StringComparer.OrdinalIgnoreCase))
+                        sb.Append(file.Name).Append('|').Append(file.Length).Append('|').Append(file.LastWriteTimeUtc.Ticks).AppendLine();
+            }
+            sb.Append(settings.texPointPx).Append(' ')
+                .Append(settings.defaultProbeRemove).Append(' ').Append(settings.defaultProbeHide).Append(' ')
+                .Append(settings.boxLavaNormalProbe).Append(' ').Append(settings.probeRes).AppendLine();
+            foreach (var bun in settings.bundles)
+            {
+                sb.AppendLine(bun.BundleName);
+                if (bun.Materials != null)
+                    foreach (var mat in bun.Materials.OrderBy(x => x.Key, StringComparer.Ordinal))
+                        sb.Append(mat.Key).Append('=').Append(mat.Value).AppendLine();
+                if (bun.GameObjects != null)
+                    foreach (var go in bun.GameObjects.OrderBy(x => x, StringComparer.Ordinal))
+                        sb.AppendLine(go);
+            }
+            #if TWEAKS
+            var lpFile = new FileInfo(new Regex(@"[.][a-z]{1,5}$", RegexOptions.IgnoreCase).Replace(levelFilename, "_levelpost.txt"));
+            if (lpFile.Exists)
+                sb.Append(lpFile.Length).Append('|').Append(lpFile.LastWriteTimeUtc.Ticks).AppendLine();
+            #endif
+            using (var sha = SHA1.Create())
+                return BitConverter.ToString(sha.ComputeHash(Encoding.UTF8.GetBytes(sb.ToString()))).Replace("-", "");
+        }
+
+        private static string CacheFile(string levelFilename, string cacheDir)
+        {
+            using (var sha = SHA1.Create())
+                return Path.Combine(cacheDir, BitConverter.ToString(sha.ComputeHash(
+                    Encoding.UTF8.GetBytes(Path.GetFullPath(levelFilename).ToLowerInvariant()))).Replace("-", "") + ".inc");
+        }
+
+        private long DataSize
+        {
+            get { return final.Length + generated.Sum(x => x == null ? 0L : x.Length) + hashes.Length * 9L; }
+        }
+
+        // The last conversion of levelFilename with these settings, or null
+        public static IncrementalCache Load(string levelFilename, string cacheDir, string settingsKey)
+        {
+            var inc = last;
+            if (inc == null || inc.levelFilename != levelFilename)
+                inc = ReadCacheFile(CacheFile(levelFilename, cacheDir), levelFilename);
+            return inc != null && inc.settingsKey == settingsKey ? inc : null;
+        }
+
+        public void Save(string cacheDir)
+        {
+            last = DataSize <= MemoryLimit ? this : null;
+            WriteCacheFile(CacheFile(levelFilename, cacheDir));
+        }
+
+        private static readonly FieldInfo[] statFields = typeof(ConvertStats).GetFields();
+
+        public static ConvertStats CopyStats(ConvertStats stats)
+        {
+            var copy = new ConvertStats();
+            foreach (var field in statFields)
+                field.SetValue(copy, field.GetValue(stats));
+            return copy;
+        }
+
+        private static byte[] ReadBytes(BinaryReader r)
+        {
+            int n = r.ReadInt32();
+            if (n == -1)
+                return null;
+            var buf = r.ReadBytes(n);
+            if (buf.Length != n)
+                throw new EndOfStreamException();
+            return buf;
+        }
+
+        private static void WriteBytes(BinaryWriter w, byte[] buf)
+        {
+            w.Write(buf == null ? -1 : buf.Length);
+            if (buf != null)
+                w.Write(buf);
+        }
+
+        // Cache file: magic, version, level and settings key, level version,
+        // changed flag, stats, messages, types, commands (hash, handled flag,
+        // generated bytes), final bytes
+        private static IncrementalCache ReadCacheFile(string cacheFile, string levelFilename)
+        {
+            try
+            {
+                if (!File.Exists(cacheFile))
+                    return null;
+                using (var r = new BinaryReader(new BufferedStream(File.OpenRead(cacheFile), 65536)))
+                {
+                    if (r.ReadUInt32() != FileMagic || r.ReadInt32() != FileVersion || r.ReadString() != levelFilename)
+                        return null;
+                    var inc = new IncrementalCache() { levelFilename = levelFilename, settingsKey = r.ReadString(),
+                        version = r.ReadInt32(), changed = r.ReadBoolean(), stats = new ConvertStats(), messages = new List<string>() };
+                    int n = r.ReadInt32();
+                    if (n != statFields.Length)
+                        return null;
+                    foreach (var field in statFields)
+                        field.SetValue(inc.stats, r.ReadInt32());
+                    for (n = r.ReadInt32(); n > 0; n--)
+                        inc.messages.Add(r.ReadString());
+                    inc.types = new VT[r.ReadInt32()];
+                    for (int i = 0; i < inc.types.Length; i++)
+                        inc.types[i] = (VT)r.ReadInt32();
+                    n = r.ReadInt32();
+                    inc.hashes = new ulong[n];
+                    inc.handled = new bool[n];
+                    inc.generated = new byte[n][];
+                    for (int i = 0; i < n; i++)
+                    {
+                        inc.hashes[i] = r.ReadUInt64();
+                        inc.handled[i] = r.ReadBoolean();
+                        inc.generated[i] = ReadBytes(r);
+                    }
+                    inc.final = ReadBytes(r);
+                    return inc.final != null ? inc : null;
+                }
+            }
+            catch (Exception ex) when (ex is IOException || ex is FormatException || ex is OverflowException || ex is OutOfMemoryException)
+            {
+                return null;
+            }
+        }
+
+        // The sidecar is only an optimization, failing to write it is ignored
+        private void WriteCacheFile(string cacheFile)
+        {
+            string tmpFile = cacheFile + "." + Guid.NewGuid().ToString("N") + ".tmp";
+            try
+            {
+                Directory.CreateDirectory(Path.GetDirectoryName(cacheFile));
+                using (var w = new BinaryWriter(new BufferedStream(File.Create(tmpFile), 65536)))
+                {
+                    w.Write(FileMagic);
+                    w.Write(FileVersion);
+                    w.Write(levelFilename);
+                    w.Write(settingsKey);
+                    w.Write(version);
+                    w.Write(changed);
+                    w.Write(statFields.Length);
+                    foreach (var field in statFields)
+                        w.Write((int)field.GetValue(stats));
+                    w.Write(messages.Count);
+                    foreach (var msg in messages)
+                        w.Write(msg);
+                    w.Write(types.Length);
+                    foreach (var type in types)
+                        w.Write((int)type);
+                    w.Write(hashes.Length);
+                    for (int i = 0; i < hashes.Length; i++)
+                    {
+                        w.Write(hashes[i]);
+                        w.Write(handled[i]);
+                        WriteBytes(w, generated[i]);
+                    }
+                    WriteBytes(w, final);
+                }
+                File.Delete(cacheFile);
+                File.Move(tmpFile, cacheFile);
+            }
+            catch (Exception ex) when (ex is IOException || ex is UnauthorizedAccessException)
+            {
+            }
+            finally
+            {
+                try
+                {
+                    File.Delete(tmpFile);
+                }
+                catch (Exception ex) when (ex is IOException || ex is UnauthorizedAccessException)
+                {
+                }
+            }
+        }
+    }
+}
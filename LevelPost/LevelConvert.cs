@@ -5,10 +5,9 @@ using System.Text;
 using System.IO;
 using System.Threading.Tasks;
 using System.Text.RegularExpressions;
-using System.Drawing;
-using System.Drawing.Imaging;
 using YamlDotNet.RepresentationModel;
 using System.Globalization;
+using System.Diagnostics;
 
 namespace LevelPost
 {
@@ -34,6 +33,19 @@ namespace LevelPost
         public Dictionary<string, string> Materials;
         public HashSet<string> GameObjects;
         public string BundleName { get { return Path.Combine(Dir, OS, Name); } }
+
+        // Bundle at <level dir>/<Dir>/<OS>/<Name> with the contents read by BundleFiles
+        public static ConvertBundle FromInfo(string path, BundleInfo info)
+        {
+            var f = new DirectoryInfo(path);
+            return new ConvertBundle() {
+                Name = f.Name,
+                OS = f.Parent.Name,
+                Dir = f.Parent.Parent.Name,
+                Materials = info.materials,
+                GameObjects = info.gameObjects
+                };
+        }
     }
 
     class ConvertSettings
@@ -47,11 +59,18 @@ namespace LevelPost
         public bool defaultProbeHide;
         public bool boxLavaNormalProbe;
         public int probeRes;
+        public string texCacheDir; // null to only cache decoded textures in memory
+        public string incrementalDir; // sidecar directory to reuse the last conversion, null to always convert
         public List<ConvertBundle> bundles = new List<ConvertBundle>();
+        public BundleIndex bundleIndex; // index of bundles, built by the conversion when null
     }
 
     interface ILevelMod
     {
+        // Commands Init needs to look ahead at, only these are passed to Init
+        VT[] InitTypes { get; }
+        // Commands HandleCommand acts on, others are copied without decoding
+        VT[] CommandTypes { get; }
         bool Init(string levelFilename, ConvertSettings settings, Action<string> log, ConvertStats stats, List<object[]> cmds);
         bool HandleCommand(object[] cmd, List<object[]> ncmds);
         bool IsChanged();
@@ -69,6 +88,16 @@ namespace LevelPost
         private Dictionary<Guid, Guid> texMatIds = new Dictionary<Guid, Guid>();
         private Dictionary<Guid, string> matNames = new Dictionary<Guid, string>();
         private readonly HashSet<Guid> updMats = new HashSet<Guid>();
+        private readonly Dictionary<string, Task<TexData>> texLoads = new Dictionary<string, Task<TexData>>(StringComparer.OrdinalIgnoreCase);
+        // Materials left to convert per texture file, its load is dropped after the last one
+        private readonly Dictionary<string, int> texUses = new Dictionary<string, int>(StringComparer.OrdinalIgnoreCase);
+        // Texture files in material order, loaded ahead of HandleCommand at most MaxLoadsAhead at a time
+        private readonly Queue<string> pendingLoads = new Queue<string>();
+        private static readonly int MaxLoadsAhead = Math.Max(2, Environment.ProcessorCount);
+        public BunRef bunRef; // materials found in the bundles are converted by BunTexMod
+
+        public VT[] InitTypes { get { return new[] { VT.CmdAssetRegisterMaterial, VT.CmdMaterialSetTexture }; } }
+        public VT[] CommandTypes { get { return new[] { VT.CmdLoadAssetFromAssetBundle, VT.CmdCreateTexture2D, VT.CmdAssetRegisterMaterial }; } }
 
         public bool Init(string levelFilename, ConvertSettings settings, Action<string> log, ConvertStats stats, List<object[]> cmds)
         {
@@ -83,10 +112,56 @@ namespace LevelPost
                     (string)cmd[2] == "_MainTex")
                     texMatIds.Add((Guid)cmd[3], (Guid)cmd[1]);
 
+            // Start decoding the textures that may be converted, HandleCommand picks up the results
+            foreach (var matName in matNames.Values)
+            {
+                if (matName.StartsWith("$INTERNAL$:") || matName.Equals("$"))
+                    continue;
+                var texName = matName.StartsWith("$CT$:") ? matName.Substring(5) : matName;
+                if (bunRef != null && bunRef.TryGetMaterial(texName.ToLowerInvariant(), out string newName, out ConvertBundle bun))
+                    continue;
+                var texFilename = LookupTextureFile(texName);
+                if (texFilename == null)
+                    continue;
+                texUses.TryGetValue(texFilename, out int uses);
+                texUses[texFilename] = uses + 1;
+                if (uses == 0)
+                    pendingLoads.Enqueue(texFilename);
+            }
+            StartPendingLoads();
+
             return true;
         }
 
-        private string FindTextureFile(string texName)
+        private Task<TexData> StartLoad(string texFilename)
+        {
+            return Task.Run(() => TexCache.Load(texFilename, settings.texCacheDir));
+        }
+
+        private void StartPendingLoads()
+        {
+            while (texLoads.Count < MaxLoadsAhead && pendingLoads.Count != 0)
+            {
+                var texFilename = pendingLoads.Dequeue();
+                if (texUses.ContainsKey(texFilename) && !texLoads.ContainsKey(texFilename))
+                    texLoads.Add(texFilename, StartLoad(texFilename));
+            }
+        }
+
+        // Drops the load of texFilename after its last material, so the decoded texture is not kept
+        private void TexUsed(string texFilename)
+        {
+            if (texUses.TryGetValue(texFilename, out int uses) && uses > 1)
+            {
+                texUses[texFilename] = uses - 1;
+                return;
+            }
+            texUses.Remove(texFilename);
+            texLoads.Remove(texFilename);
+            StartPendingLoads();
+        }
+
+        private string LookupTextureFile(string texName)
         {
             string texBase = texName + ".png";
             var dirs = ignore.IsMatch(texName) ? settings.texDirs : settings.texDirs.Concat(settings.ignoreTexDirs);
@@ -96,6 +171,14 @@ namespace LevelPost
                 if (File.Exists(fn))
                     return fn;
             }
+            return null;
+        }
+
+        private string FindTextureFile(string texName)
+        {
+            var fn = LookupTextureFile(texName);
+            if (fn != null)
+                return fn;
             if (ignore.IsMatch(texName))
             {
                 stats.builtInTextures++;
@@ -105,42 +188,11 @@ namespace LevelPost
             else
             {
                 stats.missingTextures++;
-                log("Missing file " + texBase);
+                log("Missing file " + texName + ".png");
             }
             return null;
         }
 
-        // Return bitmap pixels in ABGR format, top->bottom order
-        private static byte[] GetBitmapData(Bitmap bmp, out bool hasAlpha)
-        {
-            var bData = bmp.LockBits(new Rectangle(0, 0, bmp.Width, bmp.Height), ImageLockMode.ReadOnly, PixelFormat.Format32bppArgb);
-            // bData.Stride is positive for bottom->top source data
-            int stride = -bData.Stride, width = bData.Width, height = bData.Height;
-            var srcData = new byte[Math.Abs(stride) * height];
-            var dstData = new byte[width * height * 4];
-            System.Runtime.InteropServices.Marshal.Copy(bData.Scan0, srcData, 0, srcData.Length);
-            bmp.UnlockBits(bData);
-            int srcIdx = stride < 0 ? -stride * (height - 1) : 0, dstIdx = 0;
-            bool hasAlphaInt = false;
-            for (int h = 0; h < height; h++)
-            {
-                for (int w = 0; w < width; w++)
-                {
-                    dstData[dstIdx + 0] = srcData[srcIdx + 2];
-                    dstData[dstIdx + 1] = srcData[srcIdx + 1];
-                    dstData[dstIdx + 2] = srcData[srcIdx + 0];
-                    var a = dstData[dstIdx + 3] = srcData[srcIdx + 3];
-                    if (a != 255 && !hasAlphaInt)
-                        hasAlphaInt = true;
-                    srcIdx += 4;
-                    dstIdx += 4;
-                }
-                srcIdx -= width * 4 - stride;
-            }
-            hasAlpha = hasAlphaInt;
-            return dstData;
-        }
-
         private object[] MakeTexCmd(string texName, Guid texGuid, out bool blocky)
         {
             blocky = false;
@@ -148,26 +200,32 @@ namespace LevelPost
             if (texFilename == null)
                 return null;
 
-            Bitmap bmp;
+            if (!texLoads.TryGetValue(texFilename, out Task<TexData> load))
+                texLoads.Add(texFilename, load = StartLoad(texFilename));
+
+            TexData tex;
             try
             {
-                bmp = new Bitmap(texFilename);
+                using (Tracer.Begin("wait for texture", 0, texName))
+                    tex = load.GetAwaiter().GetResult();
             }
             catch (Exception ex)
             {
                 log("Error loading file " + texFilename + ": " + ex.Message);
                 return null;
             }
+            finally
+            {
+                TexUsed(texFilename);
+            }
 
-            bool hasAlpha;
-            var texData = GetBitmapData(bmp, out hasAlpha);
-            blocky = bmp.Width <= settings.texPointPx;
+            blocky = tex.width <= settings.texPointPx;
 
-            return new object[] { VT.CmdCreateTexture2D, texGuid, bmp.Width, bmp.Height,
-                    hasAlpha ? "ARGB32" : "RGB24",
+            return new object[] { VT.CmdCreateTexture2D, texGuid, tex.width, tex.height,
+                    tex.hasAlpha ? "ARGB32" : "RGB24",
                     false,
                     blocky ? "Point" : "Bilinear",
-                    texName, texData };
+                    texName, tex.pixels };
         }
 
         public bool HandleCommand(object[] cmd, List<object[]> newCmds)
@@ -281,37 +339,23 @@ namespace LevelPost
     class BunRef
     {
         private Dictionary<ConvertBundle, Guid> bundleIds = new Dictionary<ConvertBundle, Guid>();
-        private ConvertSettings settings;
+        private BundleIndex index;
         public Action<string> log;
 
         public void Init(ConvertSettings settings)
         {
-            this.settings = settings;
+            index = settings.bundleIndex != null && settings.bundleIndex.Bundles == settings.bundles ?
+                settings.bundleIndex : BundleIndex.Build(settings.bundles);
         }
 
         public bool TryGetMaterial(string name, out string newName, out ConvertBundle bundle)
         {
-            foreach (var bun in settings.bundles)
-                if (bun.Materials.TryGetValue(name, out newName))
-                {
-                    bundle = bun;
-                    return true;
-                }
-            newName = null;
-            bundle = null;
-            return false;
+            return index.TryGetMaterial(name, out newName, out bundle);
         }
 
         public bool TryGetGameObject(string name, out ConvertBundle bundle)
         {
-            foreach (var bun in settings.bundles)
-                if (bun.GameObjects.Contains(name))
-                {
-                    bundle = bun;
-                    return true;
-                }
-            bundle = null;
-            return false;
+            return index.TryGetGameObject(name, out bundle);
         }
 
         public Guid GetGuid(ConvertBundle bun, List<object[]> newCmds)
@@ -336,6 +380,10 @@ namespace LevelPost
         private HashSet<Guid> matRemoveCT = new HashSet<Guid>();
         private Dictionary<Guid, Guid> texMatIds = new Dictionary<Guid, Guid>();
 
+        public VT[] InitTypes { get { return new[] { VT.CmdMaterialSetTexture }; } }
+        public VT[] CommandTypes { get { return new[] { VT.CmdLoadAssetFromAssetBundle, VT.CmdMaterialSetTexture, VT.CmdMaterialSetColor,
+            VT.CmdCreateTexture2D, VT.CmdAssetRegisterMaterial }; } }
+
         public bool Init(string levelFilename, ConvertSettings settings, Action<string> log, ConvertStats stats, List<object[]> cmds)
         {
             this.settings = settings;
@@ -416,6 +464,9 @@ namespace LevelPost
         private readonly HashSet<Guid> convComp = new HashSet<Guid>();
         private readonly HashSet<string> unconvPrefabs= new HashSet<string>(StringComparer.OrdinalIgnoreCase);
 
+        public VT[] InitTypes { get { return new[] { VT.CmdGetComponentAtRuntime, VT.CmdGameObjectSetComponentProperty }; } }
+        public VT[] CommandTypes { get { return new[] { VT.CmdFindPrefabReference, VT.CmdInstantiatePrefab, VT.CmdGetComponentAtRuntime }; } }
+
         public bool Init(string levelFilename, ConvertSettings settings, Action<string> log, ConvertStats stats, List<object[]> cmds)
         {
             this.settings = settings;
@@ -516,6 +567,11 @@ namespace LevelPost
         private readonly HashSet<Guid> RemoveObj = new HashSet<Guid>();
         private readonly Dictionary<Guid, Guid> compObj = new Dictionary<Guid, Guid>();
 
+        public VT[] InitTypes { get { return new[] { VT.CmdGameObjectAddComponent, VT.CmdGetComponentAtRuntime, VT.CmdGameObjectSetComponentProperty }; } }
+        public VT[] CommandTypes { get { return new[] { VT.CmdGameObjectSetComponentProperty, VT.CmdCreateGameObject, VT.CmdGameObjectAddComponent,
+            VT.CmdGetComponentAtRuntime, VT.CmdGameObjectSetName, VT.CmdTransformSetParent, VT.CmdGameObjectSetLayer, VT.CmdGameObjectSetTag,
+            VT.CmdFindPrefabReference, VT.CmdInstantiatePrefab }; } }
+
         public bool Init(string levelFilename, ConvertSettings settings, Action<string> log, ConvertStats stats, List<object[]> cmds)
         {
             this.settings = settings;
@@ -723,6 +779,9 @@ namespace LevelPost
         private Dictionary<Guid, string> assetNames = new Dictionary<Guid, string>();
         private bool changed = false;
 
+        public VT[] InitTypes { get { return new VT[0]; } }
+        public VT[] CommandTypes { get { return new[] { VT.CmdFindPrefabReference, VT.CmdInstantiatePrefab, VT.CmdGetComponentAtRuntime }; } }
+
         public bool Init(string levelFilename, ConvertSettings settings, Action<string> log, ConvertStats stats, List<object[]> cmds)
         {
             this.log = log;
@@ -820,20 +879,24 @@ namespace LevelPost
 
     class LevelConvert
     {
-        public static ConvertStats Convert(string levelFilename, ConvertSettings settings, Action<string> log)
-        {
-            var level = LevelFile.ReadLevel(levelFilename);
-
-            var stats = new ConvertStats();
+        // Convert command by command, only decoding commands a mod looks at and
+        // copying the others unchanged, instead of loading the whole level.
+        public static bool Streaming = true;
 
+        private static List<ILevelMod> CreateMods(ConvertSettings settings, Action<string> log)
+        {
             var mods = new List<ILevelMod>();
+            BunRef matBunRef = null;
 
             if (settings.bundles.Any())
             {
                 var bufRef = new BunRef() { log = log };
                 bufRef.Init(settings);
                 if (settings.bundles.Any(bun => bun.Materials.Any()))
+                {
                     mods.Add(new BunTexMod() { bunRef = bufRef });
+                    matBunRef = bufRef;
+                }
                 if (settings.bundles.Any(bun => bun.GameObjects.Any()))
                     mods.Add(new EntityReplaceMod() { bunRef = bufRef });
             }
@@ -841,26 +904,274 @@ namespace LevelPost
             if (settings.defaultProbeRemove || settings.defaultProbeHide || settings.boxLavaNormalProbe)
                 mods.Add(new ReflectionProbeMod());
 
-            mods.Add(new TexMod());
+            mods.Add(new TexMod() { bunRef = matBunRef });
             #if TWEAKS
             mods.Add(new EntityTweaker());
             #endif
 
-            foreach (var mod in mods)
-                if (!mod.Init(levelFilename, settings, log, stats, level.cmds))
-                    return stats;
+            return mods;
+        }
+
+        public static ConvertStats Convert(string levelFilename, ConvertSettings settings, Action<string> log)
+        {
+            using (Tracer.Begin("convert level", 0, levelFilename))
+                return Streaming ? ConvertStreaming(levelFilename, settings, log) : ConvertLoaded(levelFilename, settings, log);
+        }
+
+        // Calls HandleCommand of the mods until one handles cmd, when tracing the
+        // time of each mod is added to the totals under traceNames
+        private static bool HandleCommand(List<ILevelMod> mods, string[] traceNames, object[] cmd, List<object[]> newCmds)
+        {
+            if (!Tracer.Enabled)
+                return mods.Any(mod => mod.HandleCommand(cmd, newCmds));
+            for (int i = 0; i < mods.Count; i++)
+            {
+                long start = Stopwatch.GetTimestamp();
+                bool handled = mods[i].HandleCommand(cmd, newCmds);
+                Tracer.Add(traceNames[i], Stopwatch.GetTimestamp() - start);
+                if (handled)
+                    return true;
+            }
+            return false;
+        }
+
+        private static string[] TraceNames(List<ILevelMod> mods, string method)
+        {
+            return mods.Select(mod => mod.GetType().Name + "." + method).ToArray();
+        }
+
+        private static bool InitMods(List<ILevelMod> mods, string levelFilename, ConvertSettings settings, Action<string> log,
+            ConvertStats stats, List<object[]> cmds)
+        {
+            var traceNames = TraceNames(mods, "Init");
+            for (int i = 0; i < mods.Count; i++)
+                using (Tracer.Begin(traceNames[i]))
+                    if (!mods[i].Init(levelFilename, settings, log, stats, cmds))
+                        return false;
+            return true;
+        }
+
+        private static void FinishMods(List<ILevelMod> mods, List<object[]> newCmds)
+        {
+            var traceNames = TraceNames(mods, "Finish");
+            for (int i = 0; i < mods.Count; i++)
+                using (Tracer.Begin(traceNames[i]))
+                    mods[i].Finish(newCmds);
+        }
+
+        // Writer for the converted level, with the commands of data before offset end copied.
+        // Opened at the first change, so a level that is not changed is not written at all.
+        private static LevelFile.CommandWriter OpenWriter(string levelFilename, byte[] data, int version, int end)
+        {
+            var writer = new LevelFile.CommandWriter(levelFilename, version, data.Length);
+            try
+            {
+                for (var r = new LevelFile.CommandReader(data); r.MoveNext() && r.Type != VT.CmdDone && r.Offset < end; )
+                    writer.Copy(r);
+            }
+            catch
+            {
+                writer.Dispose();
+                throw;
+            }
+            return writer;
+        }
+
+        private static ConvertStats ConvertStreaming(string levelFilename, ConvertSettings settings, Action<string> log)
+        {
+            byte[] data;
+            using (Tracer.Begin("read level"))
+                data = File.ReadAllBytes(levelFilename);
+
+            string incKey = null;
+            if (settings.incrementalDir != null)
+            {
+                incKey = IncrementalCache.SettingsKey(levelFilename, settings);
+                var prev = IncrementalCache.Load(levelFilename, settings.incrementalDir, incKey);
+                var prevStats = prev == null ? null : Reconvert(levelFilename, data, prev, log);
+                if (prevStats != null)
+                    return prevStats;
+            }
+
+            var stats = new ConvertStats();
+
+            var messages = new List<string>();
+            if (incKey != null)
+            {
+                var userLog = log;
+                log = msg => { lock (messages) messages.Add(msg); userLog(msg); };
+            }
+
+            var mods = CreateMods(settings, log);
 
+            // Only the commands needed for lookahead are kept in memory
+            var initTypes = new HashSet<VT>(mods.SelectMany(mod => mod.InitTypes));
+            var initCmds = new List<object[]>();
+            if (initTypes.Any())
+                using (Tracer.Begin("read lookahead commands", data.Length))
+                    for (var r = new LevelFile.CommandReader(data); r.MoveNext(); )
+                        if (initTypes.Contains(r.Type))
+                            initCmds.Add(r.Decode());
+
+            if (!InitMods(mods, levelFilename, settings, log, stats, initCmds))
+                return stats;
+            initCmds = null;
+
+            var cmdTypes = new HashSet<VT>(mods.SelectMany(mod => mod.CommandTypes));
             var newCmds = new List<object[]>();
+            var reader = new LevelFile.CommandReader(data);
+            var handleNames = TraceNames(mods, "HandleCommand");
+
+            // For the sidecar: the commands the mods look at and where the commands
+            // generated for them were written
+            var incTypes = new HashSet<VT>(initTypes.Concat(cmdTypes));
+            var hashes = new List<ulong>();
+            var handledCmds = new List<bool>();
+            var generated = new List<long>(); // start, end position pairs
+
+            LevelFile.CommandWriter writer = null;
+            try
+            {
+                var convertSpan = Tracer.Begin("convert commands", data.Length);
+                while (reader.MoveNext() && reader.Type != VT.CmdDone)
+                {
+                    bool handled = false;
+                    long genStart = writer?.Position ?? 0;
+                    if (cmdTypes.Contains(reader.Type))
+                    {
+                        var cmd = reader.Decode();
+                        handled = HandleCommand(mods, handleNames, cmd, newCmds);
+                        if (writer == null && (handled || newCmds.Count != 0))
+                        {
+                            writer = OpenWriter(levelFilename, data, reader.Version, reader.Offset);
+                            genStart = writer.Position;
+                        }
+                        foreach (var newCmd in newCmds)
+                            writer.Write(newCmd);
+                        newCmds.Clear();
+                    }
+                    if (incKey != null && incTypes.Contains(reader.Type))
+                    {
+                        hashes.Add(IncrementalCache.Hash(data, reader.Offset, reader.Size));
+                        handledCmds.Add(handled);
+                        generated.Add(genStart);
+                        generated.Add(writer?.Position ?? 0);
+                    }
+                    if (!handled)
+                        writer?.Copy(reader);
+                }
 
-            foreach (var cmd in level.cmds)
+                convertSpan.Dispose();
+
+                FinishMods(mods, newCmds);
+                bool changed = mods.Any(mod => mod.IsChanged());
+                if (writer == null && changed)
+                    writer = OpenWriter(levelFilename, data, reader.Version, data.Length);
+
+                long finalStart = writer?.Position ?? 0;
+                newCmds.Add(new object[] { VT.CmdDone });
+                if (writer != null)
+                    foreach (var newCmd in newCmds)
+                        writer.Write(newCmd);
+
+                IncrementalCache inc = null;
+                if (incKey != null)
+                {
+                    inc = new IncrementalCache() { levelFilename = levelFilename, settingsKey = incKey, version = reader.Version,
+                        types = incTypes.ToArray(), hashes = hashes.ToArray(), handled = handledCmds.ToArray(),
+                        generated = new byte[hashes.Count][], changed = changed, messages = messages };
+                    for (int i = 0; i < hashes.Count; i++)
+                        if (generated[i * 2 + 1] != generated[i * 2])
+                            inc.generated[i] = writer.ReadBack(generated[i * 2], (int)(generated[i * 2 + 1] - generated[i * 2]));
+                    // Reconvert does not write the level when it was not changed
+                    inc.final = writer != null ? writer.ReadBack(finalStart, (int)(writer.Position - finalStart)) : new byte[0];
+                }
+
+                if (changed)
+                    using (Tracer.Begin("commit level", writer.Position))
+                        writer.Commit();
+
+                if (inc != null)
+                {
+                    inc.stats = IncrementalCache.CopyStats(stats);
+                    inc.Save(settings.incrementalDir);
+                }
+            }
+            finally
             {
-                if ((VT)cmd[0] != VT.CmdDone &&
-                    !mods.Any(mod => mod.HandleCommand(cmd, newCmds)))
-                    newCmds.Add(cmd);
+                writer?.Dispose();
+            }
+            return stats;
+        }
+
+        // Repeat the last conversion on a level where none of the commands the mods
+        // look at have changed. Returns null when one has, without writing the level.
+        private static ConvertStats Reconvert(string levelFilename, byte[] data, IncrementalCache prev, Action<string> log)
+        {
+            using (Tracer.Begin("reuse conversion", data.Length))
+            {
+                var reader = new LevelFile.CommandReader(data);
+                if (reader.Version != prev.version)
+                    return null;
+                var types = new HashSet<VT>(prev.types);
+                int idx = 0;
+
+                // nothing is written when the last conversion did not change the level
+                using (var writer = prev.changed ? new LevelFile.CommandWriter(levelFilename, reader.Version, data.Length) : null)
+                {
+                    while (reader.MoveNext() && reader.Type != VT.CmdDone)
+                    {
+                        if (types.Contains(reader.Type))
+                        {
+                            if (idx == prev.hashes.Length || IncrementalCache.Hash(data, reader.Offset, reader.Size) != prev.hashes[idx])
+                                return null;
+                            if (prev.generated[idx] != null)
+                                writer?.WriteEncoded(prev.generated[idx]);
+                            if (prev.handled[idx++])
+                                continue;
+                        }
+                        writer?.Copy(reader);
+                    }
+                    if (idx != prev.hashes.Length)
+                        return null;
+                    if (writer != null)
+                    {
+                        writer.WriteEncoded(prev.final);
+                        using (Tracer.Begin("commit level", writer.Position))
+                            writer.Commit();
+                    }
+                }
+
+                foreach (var msg in prev.messages)
+                    log(msg);
+                log("Reused previous conversion, only unconverted commands changed");
+                return IncrementalCache.CopyStats(prev.stats);
             }
+        }
+
+        private static ConvertStats ConvertLoaded(string levelFilename, ConvertSettings settings, Action<string> log)
+        {
+            var level = LevelFile.ReadLevel(levelFilename);
+
+            var stats = new ConvertStats();
+
+            var mods = CreateMods(settings, log);
+
+            if (!InitMods(mods, levelFilename, settings, log, stats, level.cmds))
+                return stats;
+
+            var newCmds = new List<object[]>();
+            var handleNames = TraceNames(mods, "HandleCommand");
+
+            using (Tracer.Begin("convert commands"))
+                foreach (var cmd in level.cmds)
+                {
+                    if ((VT)cmd[0] != VT.CmdDone &&
+                        !HandleCommand(mods, handleNames, cmd, newCmds))
+                        newCmds.Add(cmd);
+                }
 
-            foreach (var mod in mods)
-                mod.Finish(newCmds);
+            FinishMods(mods, newCmds);
 
             newCmds.Add(new object[] { VT.CmdDone });
 
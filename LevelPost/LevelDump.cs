@@ -11,10 +11,13 @@ namespace LevelPost
         public static List<string> DumpLines(string filename)
         {
             var lines = new List<string>();
-            foreach (var cmd in LevelFile.ReadLevel(filename).cmds)
+            // the arrays are only counted, so large assets are not decoded
+            var level = LevelFile.LazyLevel.Open(filename);
+            for (int i = 0; i < level.Count; i++)
             {
-                lines.Add(LevelFile.FmtCmd(cmd));
+                lines.Add(LevelFile.FmtCmd(level.Summarize(i)));
                 #if false
+                var cmd = level.Decode(i);
                 if ((VT)cmd[0] == VT.CmdSaveAsset && (VT)((object [])cmd[2])[0] == VT.LevelGeometry)
                 {
                     object[] segs = (object[])((object[])cmd[2])[3];
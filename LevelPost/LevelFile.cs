@@ -120,6 +120,69 @@ namespace LevelPost
         public float x, y, z, w;
     }
 
+    // Mesh asset with the vertex data in flat arrays, a null array is stored as absent (-1).
+    // colors and colors32 are only written when not null (version 4 flags).
+    public class MeshData
+    {
+        public string name;
+        public float[] verts; // x, y, z
+        public float[] uv, uv2, uv3; // x, y
+        public float[] norms; // x, y, z
+        public float[] tangs; // x, y, z, w
+        public float[] colors; // r, g, b, a
+        public byte[] colors32; // r, g, b, a
+        public byte[] boneWeights; // 4 ints, 4 floats per vertex (version 4)
+        public float[] bindposes; // 4 x Vector4 per bone (version 4)
+        public int[][] tris; // indices per submesh
+    }
+
+    // Element counts of the arrays of a mesh, -1 for absent, to format it without its data
+    class MeshSummary
+    {
+        public string name;
+        public int verts, uv, uv2, uv3, norms, tangs, colors, colors32, boneWeights, bindposes;
+        public int[] tris; // index count per submesh
+
+        private static int Count(Array a, int stride)
+        {
+            return a == null ? -1 : a.Length / stride;
+        }
+
+        public static MeshSummary Of(MeshData mesh)
+        {
+            return new MeshSummary() {
+                name = mesh.name,
+                verts = Count(mesh.verts, 3),
+                uv = Count(mesh.uv, 2),
+                uv2 = Count(mesh.uv2, 2),
+                uv3 = Count(mesh.uv3, 2),
+                norms = Count(mesh.norms, 3),
+                tangs = Count(mesh.tangs, 4),
+                colors = Count(mesh.colors, 4),
+                colors32 = Count(mesh.colors32, 4),
+                boneWeights = Count(mesh.boneWeights, 32),
+                bindposes = Count(mesh.bindposes, 16),
+                tris = mesh.tris == null ? null : Array.ConvertAll(mesh.tris, x => Count(x, 1))
+            };
+        }
+    }
+
+    // Stands in for an array that was skipped instead of decoded, formatted like
+    // FmtFields formats the decoded array
+    class ArraySummary
+    {
+        public VT type;
+        public int count;
+        public int firstCount = -1; // element count of the only element of an IntArrayArray
+
+        public override string ToString()
+        {
+            if (type == VT.IntArrayArray && count == 1 && firstCount >= 0)
+                return "IntArray[1][" + firstCount + "]";
+            return (type == VT.IntArrayArray ? "IntArray" : (type & ~VT.ArrayFlag).ToString()) + "[" + count + "]";
+        }
+    }
+
     public class Level
     {
         public int version;
@@ -167,7 +230,7 @@ namespace LevelPost
             { VT.CmdSaveAsset, new string[] { "id", "value" } },
             { VT.CmdLoadAssetBundle, new string[] { "dir", "file", "newBundleId" } },
             { VT.CmdLoadAssetFromAssetBundle, new string[] { "name", "bundleId", "newObjId" } },
-            { VT.CmdCreateMaterial, new string[] { "newMatId", "shaderId", "gpuInst", "texId", "texOfs", "texScale", "queue", "kws", "name" } },
+            { VT.CmdCreateMaterial, new string[] { "newMatId", "shaderId", "color", "gpuInst", "texId", "texOfs", "texScale", "queue", "kws", "name" } },
             { VT.CmdMaterialSetTexture, new string[] { "matId", "propName", "texId" } },
             { VT.CmdMaterialSetColor, new string[] { "matId", "propName", "color" } },
             { VT.CmdCreateTexture2D, new string[] { "newTexId", "width", "height", "fmt", "mipmap", "filter", "name", "pixels" } },
@@ -236,6 +299,105 @@ namespace LevelPost
             
         };
 
+        // The tables above indexed by type, so a lookup is a single array access.
+        // Every VT value is below SchemaCount.
+        private const int SchemaCount = 512;
+        private static readonly VT[][] schemas = Index(objTypes);
+        private static readonly string[][] schemaFieldNames = Index(fieldNames);
+        // Size of all fields of a schema when they are fixed size, otherwise 0
+        private static readonly int[] schemaSizes = BuildSizes(true);
+        // Size of a value that has no length or presence prefix, otherwise 0
+        private static readonly int[] fixedSizes = BuildSizes(false);
+
+        // Object type names as stored in the file ("LevelData+SpawnPoint"), both ways
+        private static readonly string[] typeNames = new string[SchemaCount];
+        private static readonly Dictionary<string, VT> typeByName = BuildTypeNames();
+
+        private static T[] Index<T>(Dictionary<VT, T> table) where T : class
+        {
+            var a = new T[SchemaCount];
+            foreach (var kv in table)
+                a[(int)kv.Key] = kv.Value;
+            return a;
+        }
+
+        private static VT[] Schema(VT type)
+        {
+            return (uint)type < SchemaCount ? schemas[(int)type] : null;
+        }
+
+        private static int PrimitiveSize(VT type)
+        {
+            switch (type)
+            {
+                case VT.Bool:
+                case VT.Byte:
+                    return 1;
+                case VT.Int:
+                case VT.UInt:
+                case VT.Float:
+                case VT.Color32:
+                    return 4;
+                case VT.Guid:
+                    return 16;
+                default:
+                    return 0;
+            }
+        }
+
+        private static int SchemaSize(VT type)
+        {
+            var fldTypes = schemas[(int)type];
+            if (fldTypes == null)
+                return 0;
+            int size = 0;
+            foreach (var fldType in fldTypes)
+            {
+                int fldSize = ValueSize(fldType);
+                if (fldSize == 0)
+                    return 0;
+                size += fldSize;
+            }
+            return size;
+        }
+
+        private static int ValueSize(VT type)
+        {
+            int size = PrimitiveSize(type);
+            if (size != 0 || (type & (VT.ObjectFlag | VT.ArrayFlag | VT.CmdFlag)) != 0)
+                return size;
+            return SchemaSize(type); // Vector3, Matrix4x4, ...
+        }
+
+        private static int[] BuildSizes(bool fields)
+        {
+            var sizes = new int[SchemaCount];
+            for (int i = 0; i < SchemaCount; i++)
+                sizes[i] = fields ? SchemaSize((VT)i) : ValueSize((VT)i);
+            return sizes;
+        }
+
+        private static Dictionary<string, VT> BuildTypeNames()
+        {
+            var byName = new Dictionary<string, VT>();
+            foreach (var name in Enum.GetNames(typeof(VT)))
+            {
+                var type = (VT)Enum.Parse(typeof(VT), name);
+                byName[name] = type;
+                byName[name.Replace("__", "+")] = type;
+            }
+            for (int i = 0; i < SchemaCount; i++)
+                typeNames[i] = Enum.GetName(typeof(VT), (VT)i)?.Replace("__", "+");
+            return byName;
+        }
+
+        private static VT TypeByName(string name)
+        {
+            if (!typeByName.TryGetValue(name, out VT type))
+                throw new Exception("Unknown type " + name);
+            return type;
+        }
+
         private static readonly Dictionary<Type, VT> typeVT = new Dictionary<Type, VT> {
             { typeof(string), VT.String },
             { typeof(bool), VT.Bool },
@@ -248,20 +410,36 @@ namespace LevelPost
             { typeof(Vector4), VT.Vector4 }
         };
 
-        private static string ReadString(Stream s)
-        {
-            int n = ReadInt32(s);
-            return n == -1 ? null : UTF8Encoding.UTF8.GetString(ReadBytes(s, n));
-        }
-
+        // reads from reader, writes to writer
         private class FieldStream
         {
-            public Stream stream;
+            public LevelReader reader;
+            public LevelWriter writer;
             public int version;
         
-            private object ReadMesh()
+            private float[] ReadFloats(int stride)
+            {
+                int n = reader.ReadInt32();
+                if (n == -1)
+                    return null;
+                if (n < 0 || n > int.MaxValue / (stride * sizeof(float)))
+                    throw new Exception("Invalid array size " + n);
+                return reader.ReadFloats(n * stride);
+            }
+
+            private void WriteFloats(float[] a, int stride)
             {
-                object[] ret = new object[12 + 1];
+                if (a == null) {
+                    writer.WriteInt32(-1);
+                    return;
+                }
+                writer.WriteInt32(a.Length / stride);
+                writer.WriteFloats(a);
+            }
+
+            private MeshData ReadMesh()
+            {
+                var mesh = new MeshData();
 
                 int flags;
                 if (version == 3)
@@ -270,26 +448,40 @@ namespace LevelPost
                 }
                 else
                 {
-                    flags = ReadInt32(stream);
+                    flags = reader.ReadInt32();
                 }
-            
-                ret[0] = VT.Mesh;
-                ret[1] = ReadString(stream);
-                ret[2] = ReadField(VT.Vector3Array);
-                ret[3] = ReadField(VT.Vector2Array);
-                ret[4] = ReadField(VT.Vector2Array);
-                ret[5] = ReadField(VT.Vector2Array);
-                ret[6] = ReadField(VT.Vector3Array);
-                ret[7] = ReadField(VT.Vector4Array);
-                ret[8] = (flags & 1) != 0 ? ReadField(VT.ColorArray) : null;
-                ret[9] = (flags & 2) != 0 ? ReadField(VT.Color32Array) : null;
-                ret[10] = version >= 4 ? ReadField(VT.BoneWeightArray) : null;
-                ret[11] = version >= 4 ? ReadField(VT.Matrix4x4Array) : null;
-                ret[12] = ReadField(VT.IntArrayArray);
-                return ret;
+
+                mesh.name = reader.ReadString();
+                mesh.verts = ReadFloats(3);
+                mesh.uv = ReadFloats(2);
+                mesh.uv2 = ReadFloats(2);
+                mesh.uv3 = ReadFloats(2);
+                mesh.norms = ReadFloats(3);
+                mesh.tangs = ReadFloats(4);
+                if ((flags & 1) != 0)
+                    mesh.colors = ReadFloats(4);
+                if ((flags & 2) != 0)
+                    mesh.colors32 = (byte[])ReadField(VT.Color32Array);
+                if (version >= 4)
+                {
+                    int n = reader.ReadInt32();
+                    mesh.boneWeights = n == -1 ? null : reader.ReadBytes(checked(n * 32));
+                    mesh.bindposes = ReadFloats(16);
+                }
+                int subs = reader.ReadInt32();
+                if (subs != -1)
+                {
+                    mesh.tris = new int[subs][];
+                    for (int i = 0; i < subs; i++)
+                    {
+                        int n = reader.ReadInt32();
+                        mesh.tris[i] = n == -1 ? null : reader.ReadInts(n);
+                    }
+                }
+                return mesh;
             }
 
-            private void WriteMesh(object[] val)
+            private void WriteMesh(MeshData mesh)
             {
                 int flags;
                 if (version == 3)
@@ -298,38 +490,56 @@ namespace LevelPost
                 }
                 else
                 {
-                    flags = (val[8] != null && ((object[])val[8]).Length != 0 ? 1 :0) +
-                        (val[9] != null && ((object[])val[9]).Length != 0 ? 2 : 0);
-                    WriteInt32(stream, flags);
-                }
-
-                WriteString(stream, (string)val[1]);
-                WriteField(VT.Vector3Array, val[2]);
-                WriteField(VT.Vector2Array, val[3]);
-                WriteField(VT.Vector2Array, val[4]);
-                WriteField(VT.Vector2Array, val[5]);
-                WriteField(VT.Vector3Array, val[6]);
-                WriteField(VT.Vector4Array, val[7]);
+                    flags = (mesh.colors != null ? 1 : 0) + (mesh.colors32 != null ? 2 : 0);
+                    writer.WriteInt32(flags);
+                }
+
+                writer.WriteString(mesh.name);
+                WriteFloats(mesh.verts, 3);
+                WriteFloats(mesh.uv, 2);
+                WriteFloats(mesh.uv2, 2);
+                WriteFloats(mesh.uv3, 2);
+                WriteFloats(mesh.norms, 3);
+                WriteFloats(mesh.tangs, 4);
                 if ((flags & 1) != 0)
-                    WriteField(VT.ColorArray, val[8]);
+                    WriteFloats(mesh.colors, 4);
                 if ((flags & 2) != 0)
-                    WriteField(VT.Color32Array, val[9]);
+                    WriteField(VT.Color32Array, mesh.colors32);
                 if (version >= 4)
                 {
-                    WriteField(VT.BoneWeightArray, val[10]);
-                    WriteField(VT.Matrix4x4Array, val[11]);
+                    if (mesh.boneWeights == null)
+                        writer.WriteInt32(-1);
+                    else
+                    {
+                        writer.WriteInt32(mesh.boneWeights.Length / 32);
+                        writer.WriteBytes(mesh.boneWeights);
+                    }
+                    WriteFloats(mesh.bindposes, 16);
+                }
+                if (mesh.tris == null)
+                    writer.WriteInt32(-1);
+                else
+                {
+                    writer.WriteInt32(mesh.tris.Length);
+                    foreach (var sub in mesh.tris)
+                        if (sub == null)
+                            writer.WriteInt32(-1);
+                        else
+                        {
+                            writer.WriteInt32(sub.Length);
+                            writer.WriteInts(sub);
+                        }
                 }
-                WriteField(VT.IntArrayArray, val[12]);
             }
 
             public object ReadField(VT type)
             {
                 if ((type & VT.ArrayFlag) != 0) {
-                    int n = ReadInt32(stream);
+                    int n = reader.ReadInt32();
                     if (n == -1)
                         return null;
                     if (type == VT.Color32Array)
-                        return ReadBytes(stream, n * 4);
+                        return reader.ReadBytes(n * 4);
                     var arr = new object[n + 1];
                     arr[0] = type;
                     type = type == VT.IntArrayArray ? VT.IntArray : (type & ~VT.ArrayFlag);
@@ -340,61 +550,55 @@ namespace LevelPost
                 switch (type)
                 {
                     case VT.Guid:
-                        return new Guid(ReadBytes(stream, 16));
+                        return reader.ReadGuid();
                     case VT.Int:
-                        return ReadInt32(stream);
+                        return reader.ReadInt32();
                     case VT.UInt:
-                        return ReadUInt32(stream);
+                        return reader.ReadUInt32();
                     case VT.Float:
-                        return ReadFloat(stream);
+                        return reader.ReadFloat();
                     case VT.String:
-                        return ReadString(stream);
+                        return reader.ReadString();
                     case VT.Bool:
-                        return stream.ReadByte() != 0;
+                        return reader.ReadByte() != 0;
                     case VT.Byte:
-                        return (byte)stream.ReadByte();
+                        return (byte)reader.ReadByte();
                     case VT.Unknown:
-                        VT tp = (VT)stream.ReadByte();
+                        VT tp = (VT)reader.ReadByte();
                         VT stp = tp & ~VT.ArrayFlag;
                         VT atp = tp & VT.ArrayFlag;
 
                         if (stp == VT.Enum) {
-                            var enumName = ReadString(stream);
+                            var enumName = reader.ReadString();
                             var enumval = new object[3];
                             enumval[0] = VT.Enum | atp;
                             enumval[1] = ReadField(VT.Int | atp);
                             enumval[2] = enumName;
                             return enumval;
                         }
-                        if (stp == VT.Object) {
-                            string typeName = ReadString(stream);
-                            if (typeName.Contains("+"))
-                                typeName = typeName.Replace("+", "__");
-                            tp = ((VT)Enum.Parse(typeof(VT), typeName)) | atp;
-                        }
+                        if (stp == VT.Object)
+                            tp = TypeByName(reader.ReadString()) | atp;
                         return ReadField(tp);
                     case VT.Vector3:
-                        var buf3 = ReadBytes(stream, sizeof(float) * 3);
-                        return new Vector3() { x = BitConverter.ToSingle(buf3, 0), y = BitConverter.ToSingle(buf3, 4),
-                            z = BitConverter.ToSingle(buf3, 8) };
+                        return new Vector3() { x = reader.ReadFloat(), y = reader.ReadFloat(), z = reader.ReadFloat() };
                     case VT.Vector4:
-                        var buf = ReadBytes(stream, sizeof(float) * 4);
-                        return new Vector4() { x = BitConverter.ToSingle(buf, 0), y = BitConverter.ToSingle(buf, 4),
-                                z = BitConverter.ToSingle(buf, 8), w = BitConverter.ToSingle(buf, 12) };
+                        return new Vector4() { x = reader.ReadFloat(), y = reader.ReadFloat(), z = reader.ReadFloat(),
+                            w = reader.ReadFloat() };
                     case VT.Mesh | VT.ObjectFlag:
-                        return stream.ReadByte() == 0 ? null : ReadMesh();
+                        return reader.ReadByte() == 0 ? null : ReadMesh();
                     case VT.Mesh | VT.ObjectFlag | VT.ExistingObjectFlag:
                         return ReadMesh();
                     default:
                         if ((type & VT.ObjectFlag) != 0) {
                             if ((type & VT.ExistingObjectFlag) == 0) {
-                                int exists = stream.ReadByte();
+                                int exists = reader.ReadByte();
                                 if (exists == 0)
                                     return null;
                             } else
                                 type &= ~VT.ExistingObjectFlag;
                         }
-                        if (!objTypes.TryGetValue(type, out VT[] fldTypes))
+                        VT[] fldTypes = Schema(type);
+                        if (fldTypes == null)
                             throw new Exception("Unknown type " + type);
 
                         object[] ret = new object[fldTypes.Length + 1];
@@ -407,23 +611,218 @@ namespace LevelPost
                 }
             }
 
+            // Like ReadField, but arrays are skipped and returned as ArraySummary
+            public object SummarizeField(VT type)
+            {
+                if ((type & VT.ArrayFlag) != 0) {
+                    int n = reader.ReadInt32();
+                    if (n == -1)
+                        return null;
+                    var summary = new ArraySummary() { type = type, count = n };
+                    if (type == VT.IntArrayArray && n == 1)
+                    {
+                        summary.firstCount = reader.ReadInt32();
+                        if (summary.firstCount > 0)
+                            reader.Skip(checked(summary.firstCount * sizeof(int)));
+                        return summary;
+                    }
+                    reader.Position -= sizeof(int);
+                    SkipField(type);
+                    return summary;
+                }
+                switch (type)
+                {
+                    case VT.Guid:
+                    case VT.Int:
+                    case VT.UInt:
+                    case VT.Float:
+                    case VT.String:
+                    case VT.Bool:
+                    case VT.Byte:
+                    case VT.Unknown:
+                    case VT.Vector3:
+                    case VT.Vector4:
+                        return ReadField(type);
+                    case VT.Mesh | VT.ObjectFlag:
+                        return reader.ReadByte() == 0 ? null : SummarizeMesh();
+                    case VT.Mesh | VT.ObjectFlag | VT.ExistingObjectFlag:
+                        return SummarizeMesh();
+                }
+                if ((type & VT.ObjectFlag) != 0) {
+                    if ((type & VT.ExistingObjectFlag) == 0) {
+                        if (reader.ReadByte() == 0)
+                            return null;
+                    } else
+                        type &= ~VT.ExistingObjectFlag;
+                }
+                VT[] fldTypes = Schema(type);
+                if (fldTypes == null)
+                    throw new Exception("Unknown type " + type);
+                object[] ret = new object[fldTypes.Length + 1];
+                ret[0] = type;
+                for (int l = fldTypes.Length, i = 0; i < l; i++)
+                    ret[i + 1] = SummarizeField(fldTypes[i]);
+                return ret;
+            }
+
+            // Reads an array count and skips the elements
+            private int SkipCount(int elementSize)
+            {
+                int n = reader.ReadInt32();
+                if (n > 0)
+                    reader.Skip(checked(n * elementSize));
+                return n;
+            }
+
+            private MeshSummary SummarizeMesh()
+            {
+                var mesh = new MeshSummary() { colors = -1, colors32 = -1, boneWeights = -1, bindposes = -1 };
+                int flags = version == 3 ? 1 : reader.ReadInt32();
+                mesh.name = reader.ReadString();
+                mesh.verts = SkipCount(3 * sizeof(float));
+                mesh.uv = SkipCount(2 * sizeof(float));
+                mesh.uv2 = SkipCount(2 * sizeof(float));
+                mesh.uv3 = SkipCount(2 * sizeof(float));
+                mesh.norms = SkipCount(3 * sizeof(float));
+                mesh.tangs = SkipCount(4 * sizeof(float));
+                if ((flags & 1) != 0)
+                    mesh.colors = SkipCount(4 * sizeof(float));
+                if ((flags & 2) != 0)
+                    mesh.colors32 = SkipCount(4);
+                if (version >= 4)
+                {
+                    mesh.boneWeights = SkipCount(32);
+                    mesh.bindposes = SkipCount(16 * sizeof(float));
+                }
+                int subs = reader.ReadInt32();
+                if (subs != -1)
+                {
+                    mesh.tris = new int[subs];
+                    for (int i = 0; i < subs; i++)
+                        mesh.tris[i] = SkipCount(sizeof(int));
+                }
+                return mesh;
+            }
+
+            private void SkipFloats(int stride)
+            {
+                int n = reader.ReadInt32();
+                if (n != -1)
+                    reader.Skip(checked(n * stride * sizeof(float)));
+            }
+
+            private void SkipMesh()
+            {
+                int flags = version == 3 ? 1 : reader.ReadInt32();
+                SkipField(VT.String);
+                SkipFloats(3); // verts
+                SkipFloats(2); // uv
+                SkipFloats(2); // uv2
+                SkipFloats(2); // uv3
+                SkipFloats(3); // norms
+                SkipFloats(4); // tangs
+                if ((flags & 1) != 0)
+                    SkipFloats(4);
+                if ((flags & 2) != 0)
+                    SkipField(VT.Color32Array);
+                if (version >= 4)
+                {
+                    SkipFloats(8); // boneWeights
+                    SkipFloats(16); // bindposes
+                }
+                int subs = reader.ReadInt32();
+                for (int i = 0; i < subs; i++)
+                    SkipFloats(1); // tris
+            }
+
+            // Advance past a value like ReadField without creating it
+            public void SkipField(VT type)
+            {
+                if ((type & VT.ArrayFlag) != 0) {
+                    int n = reader.ReadInt32();
+                    if (n == -1)
+                        return;
+                    type = type == VT.IntArrayArray ? VT.IntArray : (type & ~VT.ArrayFlag);
+                    int size = fixedSizes[(int)type];
+                    if (size != 0)
+                        reader.Skip(checked(n * size));
+                    else
+                        for (int i = 0; i < n; i++)
+                            SkipField(type);
+                    return;
+                }
+                switch (type)
+                {
+                    case VT.String:
+                        int len = reader.ReadInt32();
+                        if (len != -1)
+                            reader.Skip(len);
+                        return;
+                    case VT.Unknown:
+                        VT tp = (VT)reader.ReadByte();
+                        VT stp = tp & ~VT.ArrayFlag;
+                        VT atp = tp & VT.ArrayFlag;
+
+                        if (stp == VT.Enum) {
+                            SkipField(VT.String);
+                            SkipField(VT.Int | atp);
+                            return;
+                        }
+                        if (stp == VT.Object)
+                            tp = TypeByName(reader.ReadString()) | atp;
+                        SkipField(tp);
+                        return;
+                    case VT.Mesh | VT.ObjectFlag:
+                        if (reader.ReadByte() != 0)
+                            SkipMesh();
+                        return;
+                    case VT.Mesh | VT.ObjectFlag | VT.ExistingObjectFlag:
+                        SkipMesh();
+                        return;
+                    default:
+                        int size = fixedSizes[(int)type];
+                        if (size != 0) {
+                            reader.Skip(size);
+                            return;
+                        }
+                        if ((type & VT.ObjectFlag) != 0) {
+                            if ((type & VT.ExistingObjectFlag) == 0) {
+                                if (reader.ReadByte() == 0)
+                                    return;
+                            } else
+                                type &= ~VT.ExistingObjectFlag;
+                        }
+                        VT[] fldTypes = Schema(type);
+                        if (fldTypes == null)
+                            throw new Exception("Unknown type " + type);
+                        size = schemaSizes[(int)type];
+                        if (size != 0) {
+                            reader.Skip(size);
+                            return;
+                        }
+                        foreach (var fldType in fldTypes)
+                            SkipField(fldType);
+                        return;
+                }
+            }
+
             public void WriteField(VT type, object val)
             {
                 if ((type & VT.ArrayFlag) != 0) {
                     if (val == null) {
-                        WriteInt32(stream, -1);
+                        writer.WriteInt32(-1);
                         return;
                     }
                     if (type == VT.Color32Array && val is byte[] bs)
                     {
-                        WriteInt32(stream, bs.Length >> 2);
-                        WriteBytes(stream, bs);
+                        writer.WriteInt32(bs.Length >> 2);
+                        writer.WriteBytes(bs);
                     }
                     else
                     {
                         object[] a = (object[])val;
                         int n = a.Length - 1;
-                        WriteInt32(stream, n);
+                        writer.WriteInt32(n);
                         type = type == VT.IntArrayArray ? VT.IntArray : (type & ~VT.ArrayFlag);
                         for (int i = 1; i <= n; i++)
                             WriteField(type, a[i]);
@@ -433,53 +832,53 @@ namespace LevelPost
                 switch (type)
                 {
                     case VT.Guid:
-                        WriteBytes(stream, ((Guid)val).ToByteArray());
+                        writer.WriteGuid((Guid)val);
                         return;
                     case VT.Int:
-                        WriteInt32(stream, (Int32)val);
+                        writer.WriteInt32((Int32)val);
                         return;
                     case VT.UInt:
-                        WriteUInt32(stream, (UInt32)val);
+                        writer.WriteUInt32((UInt32)val);
                         return;
                     case VT.Float:
-                        WriteFloat(stream, (float)val);
+                        writer.WriteFloat((float)val);
                         return;
                     case VT.String:
-                        WriteString(stream, (string)val);
+                        writer.WriteString((string)val);
                         return;
                     case VT.Bool:
-                        stream.WriteByte((bool)val ? (byte)1 : (byte)0);
+                        writer.WriteByte((bool)val ? (byte)1 : (byte)0);
                         return;
                     case VT.Byte:
-                        stream.WriteByte((byte)val);
+                        writer.WriteByte((byte)val);
                         return;
                     case VT.Vector3:
                         Vector3 v3 = (Vector3)val;
-                        WriteBytes(stream, BitConverter.GetBytes(v3.x));
-                        WriteBytes(stream, BitConverter.GetBytes(v3.y));
-                        WriteBytes(stream, BitConverter.GetBytes(v3.z));
+                        writer.WriteFloat(v3.x);
+                        writer.WriteFloat(v3.y);
+                        writer.WriteFloat(v3.z);
                         return;
                     case VT.Vector4:
                         Vector4 v4 = (Vector4)val;
-                        WriteBytes(stream, BitConverter.GetBytes(v4.x));
-                        WriteBytes(stream, BitConverter.GetBytes(v4.y));
-                        WriteBytes(stream, BitConverter.GetBytes(v4.z));
-                        WriteBytes(stream, BitConverter.GetBytes(v4.w));
+                        writer.WriteFloat(v4.x);
+                        writer.WriteFloat(v4.y);
+                        writer.WriteFloat(v4.z);
+                        writer.WriteFloat(v4.w);
                         return;
                     case VT.Unknown:
                         VT valtp;
                         if (val is object[] obj) {
                             valtp = (VT)obj[0];
                             if ((valtp & VT.ObjectFlag) != 0) {
-                                stream.WriteByte((byte)(VT.Object | (valtp & VT.ArrayFlag)));
-                                WriteString(stream, Enum.GetName(typeof(VT), valtp & ~VT.ArrayFlag).Replace("__", "+"));
+                                writer.WriteByte((byte)(VT.Object | (valtp & VT.ArrayFlag)));
+                                writer.WriteString(typeNames[(int)(valtp & ~VT.ArrayFlag)]);
                             } else if ((valtp & ~VT.ArrayFlag) == VT.Enum) {
-                                stream.WriteByte((byte)valtp);
-                                WriteString(stream, (string)obj[2]);
+                                writer.WriteByte((byte)valtp);
+                                writer.WriteString((string)obj[2]);
                                 valtp = VT.Int | (valtp & VT.ArrayFlag);
                                 val = obj[1];
                             } else {
-                                stream.WriteByte((byte)valtp);
+                                writer.WriteByte((byte)valtp);
                             }
                         } else {
                             Type t = val.GetType();
@@ -491,28 +890,29 @@ namespace LevelPost
                             if (!typeVT.TryGetValue(t, out valtp))
                                 throw new Exception("Cannot write as unknown " + t);
                             valtp |= atp;
-                            stream.WriteByte((byte)valtp);
+                            writer.WriteByte((byte)valtp);
                         }
                         WriteField(valtp, val);
                         return;
                     case VT.Mesh | VT.ObjectFlag:
-                        stream.WriteByte(val == null ? (byte)0 : (byte)1);
+                        writer.WriteByte(val == null ? (byte)0 : (byte)1);
                         if (val != null)
-                            WriteMesh((object[])val);
+                            WriteMesh((MeshData)val);
                         return;
                     case VT.Mesh | VT.ObjectFlag | VT.ExistingObjectFlag:
-                        WriteMesh((object[])val);
+                        WriteMesh((MeshData)val);
                         return;
                     default:
                         if ((type & VT.ObjectFlag) != 0) {
                             if ((type & VT.ExistingObjectFlag) == 0) {
-                                stream.WriteByte(val == null ? (byte)0 : (byte)1);
+                                writer.WriteByte(val == null ? (byte)0 : (byte)1);
                                 if (val == null)
                                     return;
                             } else
                                 type &= ~VT.ExistingObjectFlag;
                         }
-                        if (!objTypes.TryGetValue(type, out VT[] fldTypes))
+                        VT[] fldTypes = Schema(type);
+                        if (fldTypes == null)
                             throw new Exception("Unknown type " + type);
 
                         object[] valobj = (object[])val;
@@ -528,24 +928,30 @@ namespace LevelPost
         private class CmdStream
         {
             private readonly FieldStream stream;
-            private Dictionary<Guid, String> AssetTypes = new Dictionary<Guid, String>();
-            public CmdStream(Stream s, int version)
+            private Dictionary<Guid, VT> AssetTypes = new Dictionary<Guid, VT>(); // VT.Unknown if not a known type
+            public CmdStream(LevelWriter w, int version)
             {
-                stream = new FieldStream() { stream = s, version = version };
+                stream = new FieldStream() { writer = w, version = version };
+            }
+
+            public CmdStream(LevelReader r, int version)
+            {
+                stream = new FieldStream() { reader = r, version = version };
             }
 
             private VT AssetType(Guid id)
             {
-                if (!AssetTypes.TryGetValue(id, out string typeName))
+                if (!AssetTypes.TryGetValue(id, out VT type))
                     throw new Exception("Unknown asset " + id);
-                if (typeName.StartsWith("UnityEngine."))
-                    typeName = typeName.Substring(12);
-                return (VT)Enum.Parse(typeof(VT), typeName) | VT.ExistingObjectFlag;
+                if (type == VT.Unknown)
+                    throw new Exception("Unknown type of asset " + id);
+                return type | VT.ExistingObjectFlag;
             }
 
-            public object[] Read() {
-                VT c = (VT)(ReadInt16(stream.stream) | (int)VT.CmdFlag);
-                if (!objTypes.TryGetValue(c, out VT[] fldTypes))
+            public object[] Read(bool register = true) {
+                VT c = (VT)(stream.reader.ReadInt16() | (int)VT.CmdFlag);
+                VT[] fldTypes = Schema(c);
+                if (fldTypes == null)
                 {
                     throw new Exception("Unknown command " + ((int)c & ~(int)VT.CmdFlag));
                 }
@@ -560,19 +966,21 @@ namespace LevelPost
                     }
                     cmd[i + 1] = stream.ReadField(t);
                 }
-                if (c == VT.CmdAddAssetToAssetFile)
-                    AssetTypes.Add((Guid)cmd[2], (String)cmd[3]);
+                if (register)
+                    Register(cmd);
                 return cmd;
             }
 
-            public void Write(object[] cmd) {
-                VT c = (VT)cmd[0];
-                if (!objTypes.TryGetValue(c, out VT[] fldTypes))
+            // Read the next command with its arrays as ArraySummary
+            public object[] Summarize() {
+                VT c = (VT)(stream.reader.ReadInt16() | (int)VT.CmdFlag);
+                VT[] fldTypes = Schema(c);
+                if (fldTypes == null)
                 {
-                    throw new Exception("Unknown command " + c);
+                    throw new Exception("Unknown command " + ((int)c & ~(int)VT.CmdFlag));
                 }
-
-                WriteInt16(stream.stream, (Int16)(c & ~VT.CmdFlag));
+                object[] cmd = new object[fldTypes.Length + 1];
+                cmd[0] = c;
                 for (int l = fldTypes.Length, i = 0; i < l; i++)
                 {
                     VT t = fldTypes[i];
@@ -580,103 +988,89 @@ namespace LevelPost
                     {
                         t = AssetType((Guid)cmd[i]); // assume previous arg is asset id
                     }
-                    stream.WriteField(t, cmd[i + 1]);
+                    cmd[i + 1] = stream.SummarizeField(t);
                 }
-                if (c == VT.CmdAddAssetToAssetFile)
-                    AssetTypes.Add((Guid)cmd[2], (String)cmd[3]);
+                return cmd;
             }
 
-            public List<object[]> ReadAll()
-            {
-                var cmds = new List<object[]>();
-                for (;;)
+            // Advance past the next command without decoding it, returns its type.
+            // Asset registrations are still read since later commands depend on them.
+            public VT Skip() {
+                int start = stream.reader.Position;
+                VT c = (VT)(stream.reader.ReadInt16() | (int)VT.CmdFlag);
+                VT[] fldTypes = Schema(c);
+                if (fldTypes == null)
+                {
+                    throw new Exception("Unknown command " + ((int)c & ~(int)VT.CmdFlag));
+                }
+                if (c == VT.CmdAddAssetToAssetFile)
+                {
+                    stream.reader.Position = start;
+                    Read();
+                    return c;
+                }
+                int size = schemaSizes[(int)c];
+                if (size != 0)
                 {
-                    object[] cmd = Read();
-                    cmds.Add(cmd);
-                    if (cmd[0].Equals(VT.CmdDone))
-                        break;
+                    stream.reader.Skip(size);
+                    return c;
                 }
-                return cmds;
+                Guid lastId = Guid.Empty;
+                foreach (var fldType in fldTypes)
+                {
+                    VT t = fldType;
+                    if (t == VT.Guid)
+                    {
+                        lastId = stream.reader.ReadGuid();
+                        continue;
+                    }
+                    if (t == VT.FromAsset)
+                    {
+                        t = AssetType(lastId); // assume previous arg is asset id
+                    }
+                    stream.SkipField(t);
+                }
+                return c;
             }
 
-            public void WriteAll(List<object[]> cmds)
+            public void Register(object[] cmd)
             {
-                foreach (var cmd in cmds)
+                if ((VT)cmd[0] == VT.CmdAddAssetToAssetFile)
                 {
-                    Write(cmd);
+                    string typeName = (string)cmd[3];
+                    if (typeName.StartsWith("UnityEngine."))
+                        typeName = typeName.Substring(12);
+                    AssetTypes.Add((Guid)cmd[2], typeByName.TryGetValue(typeName, out VT type) ? type : VT.Unknown);
                 }
             }
-        }
-
-        static byte[] ReadBytes(Stream s, int n)
-        {
-            byte[] buf = new byte[n];
-            s.Read(buf, 0, n);
-            return buf;
-        }
-
-        static Int32 ReadInt32(Stream s)
-        {
-            return BitConverter.ToInt32(ReadBytes(s, sizeof(Int32)), 0);
-        }
-
-        static float ReadFloat(Stream s)
-        {
-            return BitConverter.ToSingle(ReadBytes(s, sizeof(float)), 0);
-        }
-
-        static UInt32 ReadUInt32(Stream s)
-        {
-            return BitConverter.ToUInt32(ReadBytes(s, sizeof(UInt32)), 0);
-        }
-
-        static Int16 ReadInt16(Stream s)
-        {
-            return BitConverter.ToInt16(ReadBytes(s, sizeof(Int16)), 0);
-        }
 
+            public void Write(object[] cmd) {
+                VT c = (VT)cmd[0];
+                VT[] fldTypes = Schema(c);
+                if (fldTypes == null)
+                {
+                    throw new Exception("Unknown command " + c);
+                }
 
-        static void WriteBytes(Stream s, byte[] buf)
-        {
-            s.Write(buf, 0, buf.Length);
-        }
-        static void WriteInt32(Stream s, int n)
-        {
-            WriteBytes(s, new byte[]{(byte)n, (byte)(n >> 8), (byte)(n >> 16), (byte)(n >> 24) });
-        }
-        static void WriteUInt32(Stream s, uint n)
-        {
-            WriteBytes(s, new byte[]{(byte)n, (byte)(n >> 8), (byte)(n >> 16), (byte)(n >> 24) });
-        }
-        static void WriteFloat(Stream s, float f)
-        {
-            WriteBytes(s, BitConverter.GetBytes(f));
-        }
-        static void WriteInt16(Stream s, int n)
-        {
-            WriteBytes(s, new byte[]{(byte)n, (byte)(n >> 8) });
-        }
-        static void WriteString(Stream s, string str)
-        {
-            if (str == null) {
-                WriteInt32(s, -1);
-            }
-            else
-            {
-                WriteInt32(s, str.Length);
-                WriteBytes(s, UTF8Encoding.UTF8.GetBytes(str));
+                stream.writer.WriteInt16((Int16)(c & ~VT.CmdFlag));
+                for (int l = fldTypes.Length, i = 0; i < l; i++)
+                {
+                    VT t = fldTypes[i];
+                    if (t == VT.FromAsset)
+                    {
+                        t = AssetType((Guid)cmd[i]); // assume previous arg is asset id
+                    }
+                    stream.WriteField(t, cmd[i + 1]);
+                }
+                Register(cmd);
             }
         }
-        static void WriteFloats(Stream s, float[] a)
-        {
-            for (int i = 0; i < a.Length; i++)
-                WriteBytes(s, BitConverter.GetBytes(a[i]));
-        }
 
         static string FmtFields(object[] cmd)
         {
             string s = "";
-            LevelFile.fieldNames.TryGetValue((VT)cmd[0], out string[] fieldNames);
+            VT type = (VT)cmd[0];
+            string[] fieldNames = (uint)type < SchemaCount ? schemaFieldNames[(int)type] : null;
             for (int l = cmd.Length, i = 1; i < l; i++) {
                 if (fieldNames != null)
                     s += fieldNames[i - 1] + ":";
@@ -700,6 +1094,8 @@ namespace LevelPost
                                     "[" + (va.Length - 1) + "]";
                 } else if (v is Vector3 v3) {
                     v = String.Format("[{0}, {1}, {2}]", v3.x, v3.y, v3.z);
+                } else if (v is MeshData || v is MeshSummary) {
+                    v = VT.Mesh;
                 }
                 s += String.Format(i + 1 == l ? "{0}" : "{0}, ", v);
             }
@@ -712,37 +1108,331 @@ namespace LevelPost
                 return "CmdDone";
             string s = cmd[0] + " " + FmtFields(cmd);
             if ((VT)cmd[0] == VT.CmdSaveAsset)
-                s += "\n " + FmtFields(cmd[2] as object[]);
+                s += "\n " + (cmd[2] is MeshData mesh ? FmtMesh(MeshSummary.Of(mesh)) :
+                    cmd[2] is MeshSummary summary ? FmtMesh(summary) : FmtFields(cmd[2] as object[]));
             return s;
         }
 
+        static string FmtArray(string type, int count)
+        {
+            return count < 0 ? "" : type + "[" + count + "]";
+        }
+
+        static string FmtMesh(MeshSummary mesh)
+        {
+            return "name:" + mesh.name +
+                ", verts:" + FmtArray("Vector3", mesh.verts) +
+                ", uv:" + FmtArray("Vector2", mesh.uv) +
+                ", uv2:" + FmtArray("Vector2", mesh.uv2) +
+                ", uv3:" + FmtArray("Vector2", mesh.uv3) +
+                ", norms:" + FmtArray("Vector3", mesh.norms) +
+                ", tangs:" + FmtArray("Vector4", mesh.tangs) +
+                ", colors:" + FmtArray("Color", mesh.colors) +
+                ", colors32:" + FmtArray("Color32", mesh.colors32) +
+                ", boneWeights:" + FmtArray("BoneWeight", mesh.boneWeights) +
+                ", bindposes:" + FmtArray("Matrix4x4", mesh.bindposes) +
+                ", tris:" + (mesh.tris != null && mesh.tris.Length == 1 && mesh.tris[0] >= 0 ?
+                    "IntArray[1][" + mesh.tris[0] + "]" : FmtArray("IntArray", mesh.tris == null ? -1 : mesh.tris.Length));
+        }
+
+        // Returns the version
+        private static int ReadHeader(LevelReader reader)
+        {
+            if (reader.Length < 12 || reader.ReadInt32() != 0x52657631)
+                throw new Exception("Invalid file header");
+            int version = reader.ReadInt32();
+            if (version != 3 && version != 4)
+                throw new Exception("Unknown file version " + version);
+            reader.ReadInt32();
+            return version;
+        }
+
+        // Iterates the commands of a level held in memory. A command is only
+        // decoded when asked for, otherwise it is skipped and can be copied
+        // unchanged with a CommandWriter.
+        public class CommandReader
+        {
+            private readonly LevelReader reader;
+            private readonly CmdStream cmds;
+            private int start, end; // end is -1 until the command is read or skipped
+            private object[] cmd;
+
+            public int Version { get; private set; }
+            public VT Type { get; private set; }
+
+            // Location of the current command in the file data
+            public int Offset { get { return start; } }
+            public int Size { get { FindEnd(); return end - start; } }
+
+            public CommandReader(byte[] data)
+            {
+                reader = new LevelReader(data);
+                Version = ReadHeader(reader);
+                cmds = new CmdStream(reader, Version);
+                end = reader.Position;
+            }
+
+            // Move to the next command, returns false after CmdDone
+            public bool MoveNext()
+            {
+                if (Type == VT.CmdDone)
+                    return false;
+                FindEnd();
+                start = end;
+                end = -1;
+                cmd = null;
+                reader.Position = start;
+                Type = (VT)(reader.ReadInt16() | (int)VT.CmdFlag);
+                return true;
+            }
+
+            private void FindEnd()
+            {
+                if (end >= 0)
+                    return;
+                if (Type == VT.CmdAddAssetToAssetFile) // registers the asset type
+                {
+                    Decode();
+                    return;
+                }
+                reader.Position = start;
+                cmds.Skip();
+                end = reader.Position;
+            }
+
+            public object[] Decode()
+            {
+                if (cmd == null)
+                {
+                    reader.Position = start;
+                    cmd = cmds.Read();
+                    end = reader.Position;
+                }
+                return cmd;
+            }
+
+            // Write the current command as stored in the file
+            public void WriteTo(LevelWriter w)
+            {
+                FindEnd();
+                reader.WriteTo(w, start, end - start);
+            }
+        }
+
+        // Random access view of a level held in memory. Opening it scans the commands once
+        // for their type and offset, a command is only decoded when asked for. Decoded
+        // commands are kept up to CacheLimit bytes of file data, least recently used first out.
+        public class LazyLevel
+        {
+            public long CacheLimit = 64 << 20;
+
+            private readonly LevelReader reader;
+            private readonly CmdStream cmds;
+            private readonly VT[] types;
+            private readonly int[] offsets; // Count + 1, the last one is the end of CmdDone
+            private readonly object cacheLock = new object();
+            private readonly Dictionary<int, LinkedListNode<int>> cache = new Dictionary<int, LinkedListNode<int>>();
+            private readonly LinkedList<int> lru = new LinkedList<int>();
+            private readonly object[][] decoded;
+            private long cacheSize;
+
+            public int Version { get; private set; }
+            public int Count { get { return types.Length; } }
+
+            public LazyLevel(byte[] data)
+            {
+                reader = new LevelReader(data);
+                Version = ReadHeader(reader);
+                cmds = new CmdStream(reader, Version);
+                var typeList = new List<VT>();
+                var offsetList = new List<int>();
+                VT type;
+                do
+                {
+                    offsetList.Add(reader.Position);
+                    typeList.Add(type = cmds.Skip()); // also registers the asset types
+                } while (type != VT.CmdDone);
+                offsetList.Add(reader.Position);
+                types = typeList.ToArray();
+                offsets = offsetList.ToArray();
+                decoded = new object[types.Length][];
+            }
+
+            public static LazyLevel Open(string filename)
+            {
+                var data = File.ReadAllBytes(filename);
+                using (Tracer.Begin("scan level", data.Length))
+                    return new LazyLevel(data);
+            }
+
+            public VT Type(int i) { return types[i]; }
+            public int Offset(int i) { return offsets[i]; }
+            public int Size(int i) { return offsets[i + 1] - offsets[i]; }
+
+            // Indexes of the commands of the given types, all commands without types
+            public IEnumerable<int> IndexesOf(params VT[] cmdTypes)
+            {
+                for (int i = 0; i < types.Length; i++)
+                    if (cmdTypes.Length == 0 || Array.IndexOf(cmdTypes, types[i]) >= 0)
+                        yield return i;
+            }
+
+            // Decoded commands of the given types in level order
+            public IEnumerable<object[]> Commands(params VT[] cmdTypes)
+            {
+                foreach (int i in IndexesOf(cmdTypes))
+                    yield return Decode(i);
+            }
+
+            public object[] Decode(int i)
+            {
+                lock (cacheLock)
+                {
+                    if (cache.TryGetValue(i, out LinkedListNode<int> node))
+                    {
+                        lru.Remove(node);
+                        lru.AddFirst(node);
+                        return decoded[i];
+                    }
+                    reader.Position = offsets[i];
+                    var cmd = cmds.Read(false); // registered by the scan
+                    decoded[i] = cmd;
+                    cache.Add(i, lru.AddFirst(i));
+                    cacheSize += Size(i);
+                    while (cacheSize > CacheLimit && lru.Count > 1)
+                    {
+                        int last = lru.Last.Value;
+                        lru.RemoveLast();
+                        cache.Remove(last);
+                        decoded[last] = null;
+                        cacheSize -= Size(last);
+                    }
+                    return cmd;
+                }
+            }
+
+            // The command with its arrays as ArraySummary, for FmtCmd. Not cached.
+            public object[] Summarize(int i)
+            {
+                lock (cacheLock)
+                {
+                    if (decoded[i] != null)
+                        return decoded[i];
+                    reader.Position = offsets[i];
+                    return cmds.Summarize();
+                }
+            }
+        }
+
+        // Writes a level to a temporary file which replaces the original on Commit
+        public class CommandWriter : IDisposable
+        {
+            private readonly string filename, tmpFilename;
+            private readonly FileStream s;
+            private readonly LevelWriter w;
+            private readonly CmdStream cmds;
+            private bool committed;
+
+            // sizeHint is the expected file size, if known the file is allocated up front
+            public CommandWriter(string filename, int version, long sizeHint = 0)
+            {
+                this.filename = filename;
+                tmpFilename = filename + ".tmp";
+                s = new FileStream(tmpFilename, FileMode.Create, FileAccess.ReadWrite, FileShare.None, 4096);
+                if (sizeHint > 0)
+                    s.SetLength(sizeHint);
+                w = new LevelWriter(s);
+                w.WriteInt32(0x52657631);
+                w.WriteInt32(version);
+                w.WriteInt32(1);
+                cmds = new CmdStream(w, version);
+            }
+
+            // Number of bytes written so far
+            public long Position { get { return w.Position; } }
+
+            public void Write(object[] cmd)
+            {
+                cmds.Write(cmd);
+            }
+
+            // Write commands that were encoded before, e.g. by ReadBack
+            public void WriteEncoded(byte[] encoded)
+            {
+                w.WriteBytes(encoded);
+            }
+
+            // Read back n bytes written at ofs (a Position)
+            public byte[] ReadBack(long ofs, int n)
+            {
+                w.Flush();
+                long end = s.Position;
+                var buf = new byte[n];
+                s.Position = ofs;
+                for (int i = 0, len; i < n; i += len)
+                    if ((len = s.Read(buf, i, n - i)) == 0)
+                        throw new EndOfStreamException();
+                s.Position = end;
+                return buf;
+            }
+
+            // Copy the current command of r without encoding it again
+            public void Copy(CommandReader r)
+            {
+                r.WriteTo(w);
+                if (r.Type == VT.CmdAddAssetToAssetFile)
+                    cmds.Register(r.Decode());
+            }
+
+            // The new file is on disk before it replaces the original, so a crash
+            // leaves either the old or the new level
+            public void Commit()
+            {
+                w.Flush();
+                if (s.Length != w.Position)
+                    s.SetLength(w.Position);
+                s.Flush(true);
+                s.Dispose();
+                if (File.Exists(filename))
+                    File.Replace(tmpFilename, filename, null);
+                else
+                    File.Move(tmpFilename, filename);
+                committed = true;
+            }
+
+            public void Dispose()
+            {
+                w.Dispose();
+                if (committed)
+                    return;
+                s.Dispose();
+                File.Delete(tmpFilename);
+            }
+        }
+
         public static Level ReadLevel(string filename)
         {
-            using (FileStream s = new FileStream(filename, FileMode.Open, FileAccess.Read))
+            var data = File.ReadAllBytes(filename);
+            using (Tracer.Begin("ReadLevel", data.Length))
             {
-                var sig = ReadInt32(s);
-                if (sig != 0x52657631)
-                    throw new Exception("Invalid file header");
-                int version = ReadInt32(s);
-                if (version != 3 && version != 4)
-                    throw new Exception("Unknown file version " + version);
-                ReadInt32(s);
-                return new Level() { version = version, cmds = new CmdStream(s, version).ReadAll() };
+                var r = new CommandReader(data);
+                var cmds = new List<object[]>();
+                while (r.MoveNext())
+                    cmds.Add(r.Decode());
+                return new Level() { version = r.Version, cmds = cmds };
             }
         }
 
         public static void WriteLevel(string filename, Level level)
         {
-            var tmpFilename = filename + ".tmp";
-            using (FileStream s = new FileStream(tmpFilename, FileMode.Create, FileAccess.Write))
+            using (var w = new CommandWriter(filename, level.version))
             {
-                WriteInt32(s, 0x52657631);
-                WriteInt32(s, level.version);
-                WriteInt32(s, 1);
-                new CmdStream(s, level.version).WriteAll(level.cmds);
+                using (Tracer.Begin("WriteLevel"))
+                    foreach (var cmd in level.cmds)
+                        w.Write(cmd);
+                using (Tracer.Begin("commit level", w.Position))
+                    w.Commit();
             }
-            File.Delete(filename);
-            File.Move(tmpFilename, filename);
         }
     }
 }
@@ -0,0 +1,104 @@
+﻿using System;
+using System.IO;
+using System.Text;
+
+namespace LevelPost
+{
+    // Reads level file values in place from one buffer holding the whole file,
+    // so only the values themselves are allocated.
+    class LevelReader
+    {
+        private readonly byte[] buf;
+        private int pos;
+
+        public LevelReader(byte[] buf)
+        {
+            this.buf = buf;
+        }
+
+        public int Position { get { return pos; } set { pos = value; } }
+        public int Length { get { return buf.Length; } }
+
+        private int Take(int n)
+        {
+            if (n < 0 || n > buf.Length - pos)
+                throw new EndOfStreamException("Unexpected end of level file at " + pos);
+            int ofs = pos;
+            pos += n;
+            return ofs;
+        }
+
+        public void Skip(int n)
+        {
+            Take(n);
+        }
+
+        // Copy a byte range of the file unchanged to w
+        public void WriteTo(LevelWriter w, int ofs, int n)
+        {
+            w.WriteBytes(buf, ofs, n);
+        }
+
+        public byte ReadByte()
+        {
+            return buf[Take(1)];
+        }
+
+        public Int16 ReadInt16()
+        {
+            return BitConverter.ToInt16(buf, Take(sizeof(Int16)));
+        }
+
+        public Int32 ReadInt32()
+        {
+            return BitConverter.ToInt32(buf, Take(sizeof(Int32)));
+        }
+
+        public UInt32 ReadUInt32()
+        {
+            return BitConverter.ToUInt32(buf, Take(sizeof(UInt32)));
+        }
+
+        public float ReadFloat()
+        {
+            return BitConverter.ToSingle(buf, Take(sizeof(float)));
+        }
+
+        public Guid ReadGuid()
+        {
+            int ofs = Take(16);
+            return new Guid(BitConverter.ToInt32(buf, ofs), BitConverter.ToInt16(buf, ofs + 4), BitConverter.ToInt16(buf, ofs + 6),
+                buf[ofs + 8], buf[ofs + 9], buf[ofs + 10], buf[ofs + 11], buf[ofs + 12], buf[ofs + 13], buf[ofs + 14], buf[ofs + 15]);
+        }
+
+        public string ReadString()
+        {
+            int n = ReadInt32();
+            return n == -1 ? null : UTF8Encoding.UTF8.GetString(buf, Take(n), n);
+        }
+
+        public byte[] ReadBytes(int n)
+        {
+            int ofs = Take(n);
+            var ret = new byte[n];
+            Buffer.BlockCopy(buf, ofs, ret, 0, n);
+            return ret;
+        }
+
+        public float[] ReadFloats(int n)
+        {
+            int ofs = Take(checked(n * sizeof(float)));
+            var ret = new float[n];
+            Buffer.BlockCopy(buf, ofs, ret, 0, n * sizeof(float));
+            return ret;
+        }
+
+        public int[] ReadInts(int n)
+        {
+            int ofs = Take(checked(n * sizeof(int)));
+            var ret = new int[n];
+            Buffer.BlockCopy(buf, ofs, ret, 0, n * sizeof(int));
+            return ret;
+        }
+    }
+}
@@ -1,114 +1,346 @@
 ﻿using System;
 using System.Collections.Generic;
+using System.Globalization;
 using System.IO;
+using System.Runtime.InteropServices;
 using System.Text;
+using System.Threading.Tasks;
 
 namespace LevelPost
 {
+    // Exports the level render meshes as .obj + .mtl, or as binary .ply when outFilename ends with .ply.
+    // Meshes are formatted in parallel into per mesh buffers and written in level order.
     internal class LevelSaveObj
     {
-        int VertOfs = 1;
+        const int MeshesPerBatch = 64;
+
         Action<string> Log;
 
-        private void DumpMesh(StreamWriter f, object[] mesh)
+        // Growable output buffer with invariant number formatting that does not allocate
+        private class OutBuf
+        {
+            private static readonly double[] Pow10 = { 1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12 };
+
+            [StructLayout(LayoutKind.Explicit)]
+            private struct FloatBits
+            {
+                [FieldOffset(0)] public float f;
+                [FieldOffset(0)] public int i;
+            }
+
+            public byte[] data = new byte[65536];
+            public int length;
+
+            private void Reserve(int count)
+            {
+                if (length + count > data.Length)
+                    Array.Resize(ref data, Math.Max(data.Length * 2, length + count));
+            }
+
+            public void Put(char c)
+            {
+                Reserve(1);
+                data[length++] = (byte)c;
+            }
+
+            public void Put(string s)
+            {
+                Reserve(Encoding.UTF8.GetMaxByteCount(s.Length));
+                length += Encoding.UTF8.GetBytes(s, 0, s.Length, data, length);
+            }
+
+            public void PutLine(string s)
+            {
+                Put(s);
+                Put('\n');
+            }
+
+            // Digits of v (>= 0) with a '.' before the last decimals digits, filled from the end
+            private void PutDigits(long v, int decimals)
+            {
+                int digits = 1;
+                for (long lim = 10; digits < 19 && v >= lim; lim *= 10)
+                    digits++;
+                int count = Math.Max(digits, decimals + 1) + (decimals != 0 ? 1 : 0);
+                Reserve(count);
+                int pos = length + count;
+                length = pos;
+                for (int n = 0; pos > length - count; n++)
+                {
+                    if (n == decimals && n != 0)
+                        data[--pos] = (byte)'.';
+                    data[--pos] = (byte)('0' + v % 10);
+                    v /= 10;
+                }
+            }
+
+            public void PutInt(int v)
+            {
+                if (v < 0)
+                {
+                    Put('-');
+                    PutDigits(-(long)v, 0);
+                }
+                else
+                    PutDigits(v, 0);
+            }
+
+            // Rounded to 7 significant digits like float.ToString() but without exponent and culture
+            public void PutFloat(float f)
+            {
+                double v = f < 0 ? -(double)f : f;
+                if (!(v < 1e15)) // also NaN
+                {
+                    Put(f.ToString("R", CultureInfo.InvariantCulture));
+                    return;
+                }
+                int decimals = 0;
+                while (decimals < Pow10.Length - 1 && v * Pow10[decimals] < 1e6)
+                    decimals++;
+                long scaled = (long)(v * Pow10[decimals] + 0.5);
+                while (decimals > 0 && scaled % 10 == 0)
+                {
+                    scaled /= 10;
+                    decimals--;
+                }
+                if (scaled != 0 && f < 0)
+                    Put('-');
+                PutDigits(scaled, decimals);
+            }
+
+            public void PutInt32LE(int v)
+            {
+                Reserve(4);
+                data[length++] = (byte)v;
+                data[length++] = (byte)(v >> 8);
+                data[length++] = (byte)(v >> 16);
+                data[length++] = (byte)(v >> 24);
+            }
+
+            public void PutFloatLE(float f)
+            {
+                PutInt32LE(new FloatBits() { f = f }.i);
+            }
+        }
+
+        private class ExportMesh
+        {
+            public string matName;
+            public MeshData mesh;
+            public int vertOfs, uvOfs, normOfs; // 1 based obj indices of the first vertex
+        }
+
+        private static int Count(float[] a, int size)
         {
-            string name = (string)mesh[1];
-            object[] verts = (object[])mesh[2], uvs = (object[])mesh[3];
-            object[] norms = (object[])mesh[6], tris = (object[])mesh[12];
-            f.WriteLine("o " + name);
-            for (int n = verts.Length, i = 1; i < n; i++)
+            return a == null ? 0 : a.Length / size;
+        }
+
+        private static void DumpMesh(OutBuf f, ExportMesh em)
+        {
+            var mesh = em.mesh;
+            float[] verts = mesh.verts, uvs = mesh.uv, norms = mesh.norms;
+            f.PutLine("usemtl " + em.matName);
+            f.PutLine("o " + mesh.name);
+            for (int n = verts.Length, i = 0; i < n; i += 3)
             {
-                Vector3 vert = (Vector3)verts[i];
-                f.WriteLine("v " + -vert.x + " " + vert.y + " " + vert.z);
+                f.Put('v'); f.Put(' '); f.PutFloat(-verts[i]);
+                f.Put(' '); f.PutFloat(verts[i + 1]);
+                f.Put(' '); f.PutFloat(verts[i + 2]); f.Put('\n');
             }
-            for (int n = norms.Length, i = 1; i < n; i++)
+            for (int n = Count(norms, 3) * 3, i = 0; i < n; i += 3)
             {
-                Vector3 vert = (Vector3)norms[i];
-                f.WriteLine("vn " + -vert.x + " " + vert.y + " " + vert.z);
+                f.Put('v'); f.Put('n'); f.Put(' '); f.PutFloat(-norms[i]);
+                f.Put(' '); f.PutFloat(norms[i + 1]);
+                f.Put(' '); f.PutFloat(norms[i + 2]); f.Put('\n');
             }
-            for (int n = uvs.Length, i = 1; i < n; i++)
+            for (int n = Count(uvs, 2) * 2, i = 0; i < n; i += 2)
             {
-                object[] vert = (object[])uvs[i];
-                f.WriteLine("vt " + (float)vert[1] + " " + -(float)vert[2]);
+                f.Put('v'); f.Put('t'); f.Put(' '); f.PutFloat(uvs[i]);
+                f.Put(' '); f.PutFloat(-uvs[i + 1]); f.Put('\n');
             }
 
-            for (int subn = tris.Length, subi = 1; subi < subn; subi++)
+            bool hasUv = Count(uvs, 2) != 0, hasNorm = Count(norms, 3) != 0;
+            foreach (var sub in mesh.tris)
             {
-                object[] sub = (object[])tris[subi];
-                for (int fn = sub.Length, fi = 1; fi < fn; fi += 3)
+                for (int fn = sub.Length - 2, fi = 0; fi < fn; fi += 3)
                 {
-                    var line = new StringBuilder("f");
-                    for (int vn = 3, vi = vn - 1; vi >= 0; vi--)
+                    f.Put('f');
+                    for (int vi = 2; vi >= 0; vi--) // mirrored x, so reverse the winding
                     {
-                        int v = (int)sub[fi + vi];
-                        line.Append(' ');
-                        line.Append(VertOfs + v); // vert
-                        line.Append('/');
-                        line.Append(VertOfs + v); // tex
-                        line.Append('/');
-                        line.Append(VertOfs + v); // norm
+                        int v = sub[fi + vi];
+                        f.Put(' ');
+                        f.PutInt(em.vertOfs + v);
+                        if (!hasUv && !hasNorm)
+                            continue;
+                        f.Put('/');
+                        if (hasUv)
+                            f.PutInt(em.uvOfs + v);
+                        if (hasNorm)
+                        {
+                            f.Put('/');
+                            f.PutInt(em.normOfs + v);
+                        }
                     }
-                    f.WriteLine(line);
+                    f.Put('\n');
                 }
             }
-            VertOfs += verts.Length - 1;
+        }
+
+        // x, y, z, nx, ny, nz, s, t per vertex
+        private static void DumpPlyVerts(OutBuf f, ExportMesh em)
+        {
+            var mesh = em.mesh;
+            float[] verts = mesh.verts, uvs = mesh.uv, norms = mesh.norms;
+            int n = verts.Length / 3;
+            bool hasUv = Count(uvs, 2) >= n, hasNorm = Count(norms, 3) >= n;
+            for (int i = 0; i < n; i++)
+            {
+                f.PutFloatLE(-verts[i * 3]);
+                f.PutFloatLE(verts[i * 3 + 1]);
+                f.PutFloatLE(verts[i * 3 + 2]);
+                f.PutFloatLE(hasNorm ? -norms[i * 3] : 0);
+                f.PutFloatLE(hasNorm ? norms[i * 3 + 1] : 0);
+                f.PutFloatLE(hasNorm ? norms[i * 3 + 2] : 0);
+                f.PutFloatLE(hasUv ? uvs[i * 2] : 0);
+                f.PutFloatLE(hasUv ? uvs[i * 2 + 1] : 0);
+            }
+        }
+
+        private static void DumpPlyFaces(OutBuf f, ExportMesh em)
+        {
+            int ofs = em.vertOfs - 1;
+            foreach (var sub in em.mesh.tris)
+                for (int fn = sub.Length - 2, fi = 0; fi < fn; fi += 3)
+                {
+                    f.Put((char)3);
+                    f.PutInt32LE(ofs + sub[fi + 2]);
+                    f.PutInt32LE(ofs + sub[fi + 1]);
+                    f.PutInt32LE(ofs + sub[fi]);
+                }
+        }
+
+        // Formats the meshes in parallel batches and writes the buffers in order
+        private static void WriteMeshes(Stream f, List<ExportMesh> meshes, Action<OutBuf, ExportMesh> dump)
+        {
+            var bufs = new OutBuf[Math.Min(MeshesPerBatch, meshes.Count)];
+            for (int i = 0; i < bufs.Length; i++)
+                bufs[i] = new OutBuf();
+            for (int start = 0; start < meshes.Count; start += MeshesPerBatch)
+            {
+                int count = Math.Min(MeshesPerBatch, meshes.Count - start);
+                Parallel.For(0, count, i => {
+                    bufs[i].length = 0;
+                    dump(bufs[i], meshes[start + i]);
+                });
+                for (int i = 0; i < count; i++)
+                    f.Write(bufs[i].data, 0, bufs[i].length);
+            }
         }
 
         internal static void SaveObj(string filename, string outFilename, Action<string> log)
         {
-            new LevelSaveObj() { Log = log }.Run(filename, outFilename);
+            new LevelSaveObj() { Log = log }.Run(LevelFile.LazyLevel.Open(filename), outFilename);
         }
 
-        private void Run(string filename, string outFilename)
+        // Render meshes in level order with their material. Only the commands naming materials
+        // and components and the render meshes are decoded.
+        private List<ExportMesh> GetMeshes(LevelFile.LazyLevel level)
         {
             var matNames = new Dictionary<Guid, string>();
             var objMats = new Dictionary<Guid, string>();
             var meshMats = new Dictionary<Guid, string>();
             var compObj = new Dictionary<Guid, Guid>();
             var compType = new Dictionary<Guid, string>();
-            var usedMatNames = new HashSet<string>();
+            var meshAssets = new List<KeyValuePair<Guid, MeshData>>();
+            var meshComps = new List<object[]>();
 
-            using (var f = new StreamWriter(outFilename))
+            foreach (var cmd in level.Commands(VT.CmdAssetRegisterMaterial, VT.CmdLoadAssetFromAssetBundle,
+                VT.CmdGameObjectSetComponentProperty, VT.CmdGameObjectAddComponent))
             {
-                var cmds = LevelFile.ReadLevel(filename).cmds;
-                foreach (var cmd in cmds)
+                if ((VT)cmd[0] == VT.CmdAssetRegisterMaterial)
+                    matNames.Add((Guid)cmd[1], (string)cmd[3]);
+                if ((VT)cmd[0] == VT.CmdLoadAssetFromAssetBundle)
                 {
-                    if ((VT)cmd[0] == VT.CmdAssetRegisterMaterial)
-                        matNames.Add((Guid)cmd[1], (string)cmd[3]);
-                    if ((VT)cmd[0] == VT.CmdLoadAssetFromAssetBundle)
-                    {
-                        string name = (string)cmd[1];
-                        if (name.EndsWith(".mat"))
-                            name = name.Substring(0, name.Length - 4);
-                        matNames.Add((Guid)cmd[3], name);
-                    }
-                    if ((VT)cmd[0] == VT.CmdGameObjectSetComponentProperty && (string)cmd[2] == "sharedMaterial")
-                        objMats.Add(compObj[(Guid)cmd[1]], matNames[(Guid)cmd[5]]);
-                    if ((VT)cmd[0] == VT.CmdGameObjectAddComponent)
-                    {
-                        compObj[(Guid)cmd[2]] = (Guid)cmd[1];
-                        compType[(Guid)cmd[2]] = (string)cmd[3];
-                    }
+                    string name = (string)cmd[1];
+                    if (name.EndsWith(".mat"))
+                        name = name.Substring(0, name.Length - 4);
+                    matNames.Add((Guid)cmd[3], name);
                 }
-                foreach (var cmd in cmds)
+                if ((VT)cmd[0] == VT.CmdGameObjectSetComponentProperty && (string)cmd[2] == "sharedMaterial")
+                    objMats.Add(compObj[(Guid)cmd[1]], matNames[(Guid)cmd[5]]);
+                if ((VT)cmd[0] == VT.CmdGameObjectSetComponentProperty && (string)cmd[2] == "sharedMesh")
+                    meshComps.Add(cmd);
+                if ((VT)cmd[0] == VT.CmdGameObjectAddComponent)
                 {
-                    if ((VT)cmd[0] == VT.CmdSaveAsset && (VT)((object[])cmd[2])[0] == VT.Mesh)
-                    {
-                        object[] mesh = (object[])cmd[2];
-                        string name = (string)mesh[1];
-                        if (!name.Contains("__RenderMesh"))
-                            continue;
-                        //Log("mesh " + name);
-                        var matName = meshMats[(Guid)cmd[1]];
-                        f.WriteLine("usemtl " + matName);
-                        DumpMesh(f, mesh);
-                        usedMatNames.Add(matName);
-                    }
-                    if ((VT)cmd[0] == VT.CmdGameObjectSetComponentProperty && (string)cmd[2] == "sharedMesh" &&
-                        compType[(Guid)cmd[1]] == "MeshFilter")
-                        meshMats.Add((Guid)cmd[5], objMats[compObj[(Guid)cmd[1]]]);
+                    compObj[(Guid)cmd[2]] = (Guid)cmd[1];
+                    compType[(Guid)cmd[2]] = (string)cmd[3];
+                }
+            }
+            foreach (var cmd in meshComps)
+                if (compType[(Guid)cmd[1]] == "MeshFilter")
+                    meshMats.Add((Guid)cmd[5], objMats[compObj[(Guid)cmd[1]]]);
+            foreach (int i in level.IndexesOf(VT.CmdSaveAsset))
+            {
+                var cmd = level.Summarize(i);
+                if (cmd[2] is MeshSummary summary && summary.name.Contains("__RenderMesh"))
+                    meshAssets.Add(new KeyValuePair<Guid, MeshData>((Guid)cmd[1], (MeshData)level.Decode(i)[2]));
+            }
+
+            var meshes = new List<ExportMesh>();
+            int vertOfs = 1, uvOfs = 1, normOfs = 1;
+            foreach (var asset in meshAssets)
+            {
+                var mesh = asset.Value;
+                if (!meshMats.TryGetValue(asset.Key, out string matName))
+                {
+                    Log("Skipping mesh " + mesh.name + " without material");
+                    continue;
                 }
+                meshes.Add(new ExportMesh() { matName = matName, mesh = mesh, vertOfs = vertOfs, uvOfs = uvOfs, normOfs = normOfs });
+                vertOfs += mesh.verts.Length / 3;
+                uvOfs += Count(mesh.uv, 2);
+                normOfs += Count(mesh.norms, 3);
             }
+            return meshes;
+        }
+
+        private void Run(LevelFile.LazyLevel level, string outFilename)
+        {
+            var meshes = GetMeshes(level);
+
+            if (Path.GetExtension(outFilename).Equals(".ply", StringComparison.OrdinalIgnoreCase))
+            {
+                long verts = 0, faces = 0;
+                foreach (var em in meshes)
+                {
+                    verts += em.mesh.verts.Length / 3;
+                    foreach (var sub in em.mesh.tris)
+                        faces += sub.Length / 3;
+                }
+                using (var f = new FileStream(outFilename, FileMode.Create, FileAccess.Write, FileShare.None, 1 << 20))
+                {
+                    var hdr = new OutBuf();
+                    hdr.PutLine("ply");
+                    hdr.PutLine("format binary_little_endian 1.0");
+                    hdr.PutLine("comment exported by LevelPost");
+                    hdr.PutLine("element vertex " + verts);
+                    foreach (var prop in new[] { "x", "y", "z", "nx", "ny", "nz", "s", "t" })
+                        hdr.PutLine("property float " + prop);
+                    hdr.PutLine("element face " + faces);
+                    hdr.PutLine("property list uchar int vertex_indices");
+                    hdr.PutLine("end_header");
+                    f.Write(hdr.data, 0, hdr.length);
+                    WriteMeshes(f, meshes, DumpPlyVerts);
+                    WriteMeshes(f, meshes, DumpPlyFaces);
+                }
+                return;
+            }
+
+            var usedMatNames = new HashSet<string>();
+            foreach (var em in meshes)
+                usedMatNames.Add(em.matName);
+            using (var f = new FileStream(outFilename, FileMode.Create, FileAccess.Write, FileShare.None, 1 << 20))
+                WriteMeshes(f, meshes, DumpMesh);
             using (var fmtl = new StreamWriter(Path.ChangeExtension(outFilename, "mtl")))
                 foreach (var matName in usedMatNames)
                 {
@@ -122,4 +354,4 @@ namespace LevelPost
                 }
         }
     }
-}
\ No newline at end of file
+}
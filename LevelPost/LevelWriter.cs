@@ -0,0 +1,163 @@
+﻿using System;
+using System.IO;
+using System.Runtime.InteropServices;
+using System.Text;
+using System.Threading;
+
+namespace LevelPost
+{
+    // Writes level file values to one reusable buffer, which is written to the
+    // stream when full, so no value is allocated on the way.
+    class LevelWriter : IDisposable
+    {
+        private const int BufferSize = 1 << 20;
+        private static byte[] spareBuf; // kept from the last disposed writer
+
+        private readonly Stream s;
+        private byte[] buf;
+        private int pos;
+        private long flushed;
+
+        [StructLayout(LayoutKind.Explicit)]
+        private struct Bits
+        {
+            [FieldOffset(0)] public float f;
+            [FieldOffset(0)] public Guid g;
+            [FieldOffset(0)] public uint lo;
+            [FieldOffset(4)] public uint lo2;
+            [FieldOffset(8)] public uint hi;
+            [FieldOffset(12)] public uint hi2;
+        }
+
+        public LevelWriter(Stream s)
+        {
+            this.s = s;
+            buf = Interlocked.Exchange(ref spareBuf, null) ?? new byte[BufferSize];
+        }
+
+        // Number of bytes written, including the ones still buffered
+        public long Position { get { return flushed + pos; } }
+
+        // Write the buffered bytes to the stream
+        public void Flush()
+        {
+            s.Write(buf, 0, pos);
+            flushed += pos;
+            pos = 0;
+        }
+
+        // Does not flush, the buffer is given to the next writer
+        public void Dispose()
+        {
+            if (buf != null)
+                spareBuf = buf;
+            buf = null;
+        }
+
+        private int Take(int n)
+        {
+            if (n > buf.Length - pos)
+                Flush();
+            int ofs = pos;
+            pos += n;
+            return ofs;
+        }
+
+        public void WriteByte(byte b)
+        {
+            buf[Take(1)] = b;
+        }
+
+        public void WriteInt16(int n)
+        {
+            int ofs = Take(2);
+            buf[ofs] = (byte)n;
+            buf[ofs + 1] = (byte)(n >> 8);
+        }
+
+        public void WriteUInt32(uint n)
+        {
+            int ofs = Take(4);
+            buf[ofs] = (byte)n;
+            buf[ofs + 1] = (byte)(n >> 8);
+            buf[ofs + 2] = (byte)(n >> 16);
+            buf[ofs + 3] = (byte)(n >> 24);
+        }
+
+        public void WriteInt32(int n)
+        {
+            WriteUInt32((uint)n);
+        }
+
+        public void WriteFloat(float f)
+        {
+            WriteUInt32(new Bits { f = f }.lo);
+        }
+
+        // Same byte order as Guid.ToByteArray
+        public void WriteGuid(Guid g)
+        {
+            var bits = new Bits { g = g };
+            WriteUInt32(bits.lo);
+            WriteUInt32(bits.lo2);
+            WriteUInt32(bits.hi);
+            WriteUInt32(bits.hi2);
+        }
+
+        // Length prefixed UTF-8, -1 for null
+        public void WriteString(string str)
+        {
+            if (str == null)
+            {
+                WriteInt32(-1);
+                return;
+            }
+            int n = Encoding.UTF8.GetByteCount(str);
+            WriteInt32(n);
+            if (n <= buf.Length)
+                Encoding.UTF8.GetBytes(str, 0, str.Length, buf, Take(n));
+            else
+                WriteBytes(Encoding.UTF8.GetBytes(str));
+        }
+
+        public void WriteBytes(byte[] a)
+        {
+            WriteBytes(a, 0, a.Length);
+        }
+
+        public void WriteBytes(byte[] a, int ofs, int n)
+        {
+            if (n >= buf.Length) // too big to be worth copying
+            {
+                Flush();
+                s.Write(a, ofs, n);
+                flushed += n;
+                return;
+            }
+            Buffer.BlockCopy(a, ofs, buf, Take(n), n);
+        }
+
+        public void WriteFloats(float[] a)
+        {
+            WriteArray(a, a.Length * sizeof(float));
+        }
+
+        public void WriteInts(int[] a)
+        {
+            WriteArray(a, a.Length * sizeof(int));
+        }
+
+        private void WriteArray(Array a, int size)
+        {
+            for (int ofs = 0; ofs < size; )
+            {
+                if (pos == buf.Length)
+                    Flush();
+                int n = Math.Min(size - ofs, buf.Length - pos);
+                Buffer.BlockCopy(a, ofs, buf, pos, n);
+                pos += n;
+                ofs += n;
+            }
+        }
+    }
+}
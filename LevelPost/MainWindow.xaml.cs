@@ -24,6 +24,7 @@ namespace LevelPost
         private bool updating;
         private const int texDirCount = 1;
         private BundleFiles bundleFiles;
+        private BundleIndex bundleIndex;
         private readonly int[] resArray = new [] { 128, 256, 512, 1024, 2048 };
 
         private List<Tuple<string, string>> matTexs = new List<Tuple<string, string>> { 
@@ -65,6 +66,7 @@ namespace LevelPost
 
             bundleFiles = new BundleFiles();
             bundleFiles.Logger = AddMessage;
+            bundleFiles.LoadIndex(BundleFiles.DefaultIndexPath);
 
             updating = true;
             using (var key = Registry.CurrentUser.OpenSubKey(@"SOFTWARE\ArneDeBruijn\LevelPost"))
@@ -191,7 +193,9 @@ namespace LevelPost
             return msg;
         }
 
-        private bool scanAgain, scanActive, scanAgainShowErrors, scanAgainUpdateList;
+        private bool scanAgain, scanActive, scanAgainShowErrors, scanAgainUpdateList, scanUpdateList;
+        private List<string> scanAgainLines;
+        private System.Threading.CancellationTokenSource scanCancel;
         private object scanLock = new Object();
 
         private void BundlesScan(List<string> lines, bool showErrors, bool updateList)
@@ -202,25 +206,54 @@ namespace LevelPost
                 {
                     scanAgain = true;
                     scanAgainShowErrors = scanAgainShowErrors | showErrors;
+                    // a list picked by the user wins over a rescan of the text box
+                    if (updateList || !scanAgainUpdateList)
+                        scanAgainLines = lines;
                     scanAgainUpdateList = scanAgainUpdateList | updateList;
+                    if (updateList || !scanUpdateList)
+                        scanCancel.Cancel();
                     return;
                 }
                 scanAgain = false;
                 scanActive = true;
                 scanAgainShowErrors = scanAgainUpdateList = false;
+                scanCancel = new System.Threading.CancellationTokenSource();
+                scanUpdateList = updateList;
             }
+            // only bundles picked by the user, not every edit of the list
+            bool trace = showErrors && DebugOptions.IsChecked == true;
             new Task(() => {
                 for (;;)
                 {
-                    var err = new List<string>();
-                    var ok = new List<string>();
-                    int totalMat = 0, totalEnt = 0;
-                    foreach (var filename in lines)
+                    BundleResult[] results = null;
+                    if (trace)
+                        Tracer.Start();
+                    try
                     {
-                        try
+                        results = bundleFiles.ReadBundles(lines, (done, total) => {
+                            if (total > 1)
+                                Dispatcher.BeginInvoke((Action)(() => {
+                                    BunStatus.Content = "Loading " + done + " of " + total + " bundle files...";
+                                }));
+                        }, scanCancel.Token);
+                    }
+                    catch (OperationCanceledException)
+                    {
+                    }
+                    if (trace)
+                        WriteTrace("scan", false);
+                    if (results != null)
+                    {
+                        var err = new List<string>();
+                        var ok = new List<string>();
+                        int totalMat = 0, totalEnt = 0;
+                        foreach (var result in results)
                         {
-                            var info = bundleFiles.CachedBundleInfo(filename);
-                            if (!info.materials.Any() && !info.gameObjects.Any())
+                            var filename = result.path;
+                            var info = result.info;
+                            if (result.error != null)
+                                err.Add(MsgAddFilename(result.error.Message, filename));
+                            else if (!info.materials.Any() && !info.gameObjects.Any())
                                 err.Add(filename + ": No materials or entities found.");
                             else
                             {
@@ -229,28 +262,25 @@ namespace LevelPost
                                 totalEnt += info.gameObjects.Count;
                             }
                         }
-                        catch (Exception ex)
-                        {
-                            err.Add(MsgAddFilename(ex.Message, filename));
-                        }
-                    }
-                    if (err.Any() && showErrors)
-                        if (err.Count == 1)
-                            MessageBox.Show("Error adding bundle file:\n\n" + err[0].Substring(0, err[0].IndexOf(": ")) + "\n\n" + err[0].Substring(err[0].IndexOf(": ") + 2), "Bundle Files", MessageBoxButton.OK, MessageBoxImage.Error);
-                        else
-                            MessageBox.Show("Not all files could be added:\n\n" + string.Join("\n\n", err), "Bundle Files", MessageBoxButton.OK, MessageBoxImage.Error);
-                    Dispatcher.Invoke(() => {
-                        BunStatus.Content =
-                            err.Any() && !showErrors ?
-                                err.Count == 1 ? err[0] : "Cannot load " + err.Count + " bundle files" :
-                            ok.Any() ? "Loaded " + FmtCount(ok.Count, "bundle") + " with " + FmtCount(totalMat, "material") + " and " + FmtCount(totalEnt, "entity", "entities") + "." : "";
-                    });
-                    if (updateList)
-                    {
+                        bundleFiles.SaveIndex(BundleFiles.DefaultIndexPath);
+                        if (err.Any() && showErrors)
+                            if (err.Count == 1)
+                                MessageBox.Show("Error adding bundle file:\n\n" + err[0].Substring(0, err[0].IndexOf(": ")) + "\n\n" + err[0].Substring(err[0].IndexOf(": ") + 2), "Bundle Files", MessageBoxButton.OK, MessageBoxImage.Error);
+                            else
+                                MessageBox.Show("Not all files could be added:\n\n" + string.Join("\n\n", err), "Bundle Files", MessageBoxButton.OK, MessageBoxImage.Error);
                         Dispatcher.Invoke(() => {
-                            BunFile.Text = string.Join("\n", ok);
-                            UpdateAll();
+                            BunStatus.Content =
+                                err.Any() && !showErrors ?
+                                    err.Count == 1 ? err[0] : "Cannot load " + err.Count + " bundle files" :
+                                ok.Any() ? "Loaded " + FmtCount(ok.Count, "bundle") + " with " + FmtCount(totalMat, "material") + " and " + FmtCount(totalEnt, "entity", "entities") + "." : "";
                         });
+                        if (updateList)
+                        {
+                            Dispatcher.Invoke(() => {
+                                BunFile.Text = string.Join("\n", ok);
+                                UpdateAll();
+                            });
+                        }
                     }
                     lock (scanLock)
                     {
@@ -259,10 +289,14 @@ namespace LevelPost
                             scanActive = false;
                             return;
                         }
+                        lines = scanAgainLines;
                         showErrors = scanAgainShowErrors;
                         updateList = scanAgainUpdateList;
                         scanAgain = false;
                         scanAgainShowErrors = scanAgainUpdateList = false;
+                        scanAgainLines = null;
+                        scanCancel = new System.Threading.CancellationTokenSource();
+                        scanUpdateList = updateList;
                     }
                  }
             }).Start();
@@ -366,10 +400,12 @@ namespace LevelPost
             }
         }
 
-        private void Convert(string filename, ConvertSettings settings)
+        private void Convert(string filename, ConvertSettings settings, bool trace)
         {
             converting = true;
             this.Dispatcher.Invoke(() => ConvertBtn.IsEnabled = false);
+            if (trace)
+                Tracer.Start();
             try
             {
                 var stats = LevelConvert.Convert(filename, settings, (cmsg) => AddMessage(cmsg));
@@ -394,21 +430,36 @@ namespace LevelPost
             }
             finally
             {
+                if (trace)
+                    WriteTrace("convert", true);
                 converting = false;
                 this.Dispatcher.Invoke(() => ConvertBtn.IsEnabled = true);
             }
         }
 
-        private static string FmtCount(int n, string singular, string plural = null)
+        // Stops tracing and writes the trace to trace_<name>.json in the LevelPost data directory
+        private void WriteTrace(string name, bool summary)
         {
-            return n + " " + (n == 1 ? singular : plural == null ? singular + "s" : plural);
+            Tracer.Stop();
+            string filename = Path.Combine(Tracer.DefaultDir, "trace_" + name + ".json");
+            try
+            {
+                Tracer.WriteChromeTrace(filename);
+            }
+            catch (Exception ex)
+            {
+                AddMessage("Error: cannot write timing trace " + filename + ": " + ex.Message);
+                return;
+            }
+            if (summary)
+                foreach (var line in Tracer.Summary())
+                    AddMessage(line);
+            AddMessage("Timing trace written to " + filename);
         }
 
-        private static void DictListAdd<TKey, TValue>(Dictionary<TKey, List<TValue>> d, TKey key, TValue value)
+        private static string FmtCount(int n, string singular, string plural = null)
         {
-            if (!d.TryGetValue(key, out List<TValue> l))
-                d.Add(key, l = new List<TValue>());
-            l.Add(value);
+            return n + " " + (n == 1 ? singular : plural == null ? singular + "s" : plural);
         }
 
         private static string ToTitleCase(string s)
@@ -429,14 +480,13 @@ namespace LevelPost
             return string.Join(", ", list.GetRange(0, count - 1)) + " and " + list[count - 1];
         }
 
-        private void ShowDups(Dictionary<string, List<ConvertBundle>> d, string singular, string plural)
+        private void ShowDups(List<KeyValuePair<string, List<ConvertBundle>>> dups, string singular, string plural)
         {
-            var dups = d.Where(x => x.Value.Count > 1).ToList();
             if (!dups.Any())
                 return;
             if (dups.Count == 1)
-                AddMessage("Warning: " + singular + " " + dups[0].Key + " occurs in " + dups[1].Value.Count + " bundles: " + 
-                    FmtList(dups[1].Value.Select(x => x.BundleName), 5));
+                AddMessage("Warning: " + singular + " " + dups[0].Key + " occurs in " + dups[0].Value.Count + " bundles: " + 
+                    FmtList(dups[0].Value.Select(x => x.BundleName), 5));
             else
                 AddMessage("Warning: " + dups.Count + " " + plural + " occur in multiple bundles: " +
                     FmtList(dups.Select(x => x.Key), 10));
@@ -494,7 +544,10 @@ namespace LevelPost
             ConvertSettings settings = new ConvertSettings() {
                 texDirs = dirs,
                 ignoreTexDirs = ignoreDirs,
-                texPointPx = texPointPx
+                texPointPx = texPointPx,
+                texCacheDir = TexCache.DefaultDir,
+                // a manual convert always starts from scratch
+                incrementalDir = isAuto ? IncrementalCache.DefaultDir : null
             };
 
             settings.defaultProbeHide = DefaultProbes_ForceOn.IsChecked.Value;
@@ -506,8 +559,6 @@ namespace LevelPost
                 settings.probeRes = res;
 
             var paths = BundlesGet();
-            var dupMats = new Dictionary<string, List<ConvertBundle>>(StringComparer.OrdinalIgnoreCase);
-            var dupGOs = new Dictionary<string, List<ConvertBundle>>(StringComparer.OrdinalIgnoreCase);
             foreach (var path in paths)
             {
                 BundleInfo info;
@@ -522,18 +573,8 @@ namespace LevelPost
                 }
 
                 var f = new DirectoryInfo(path);
-                var convBun = new ConvertBundle() {
-                    Name = f.Name,
-                    OS = f.Parent.Name,
-                    Dir = f.Parent.Parent.Name, 
-                    Materials = info.materials,
-                    GameObjects = info.gameObjects
-                    };
+                var convBun = ConvertBundle.FromInfo(path, info);
                 settings.bundles.Add(convBun);
-                foreach (var mat in convBun.Materials)
-                    DictListAdd(dupMats, mat.Key, convBun);
-                foreach (var go in convBun.GameObjects)
-                    DictListAdd(dupGOs, go, convBun);
 
                 var parts = new List<string>();
                 int n;
@@ -553,10 +594,15 @@ namespace LevelPost
                     AddMessage("The bundle file must be at " + Path.Combine(levelDir, convBun.BundleName));
                 }
             }
-            ShowDups(dupMats, "material", "materials");
-            ShowDups(dupGOs, "entity", "entities");
+            bundleFiles.SaveIndex(BundleFiles.DefaultIndexPath);
+            // only bundles read again since the last convert are re-indexed
+            bundleIndex = BundleIndex.Update(bundleIndex, settings.bundles);
+            settings.bundleIndex = bundleIndex;
+            ShowDups(bundleIndex.MaterialConflicts(), "material", "materials");
+            ShowDups(bundleIndex.EntityConflicts(), "entity", "entities");
 
-            new Task(() => Convert(filename, settings)).Start();
+            bool trace = DebugOptions.IsChecked == true;
+            new Task(() => Convert(filename, settings, trace)).Start();
         }
 
         private void ConvertBtn_Click(object sender, RoutedEventArgs e)
@@ -703,9 +749,10 @@ namespace LevelPost
         private void SaveObjBtn_Click(object sender, RoutedEventArgs e)
         {
             string filename = LvlFile.Text;
+            string ext = Keyboard.Modifiers.HasFlag(ModifierKeys.Shift) ? "ply" : "obj";
             SaveObjBtn.IsEnabled = false;
             new Task(() => {
-                var outName = Path.ChangeExtension(filename, "obj");
+                var outName = Path.ChangeExtension(filename, ext);
                 AddMessage(null);
                 AddMessage("Exporting level mesh from " + filename + " to " + outName);
                 try
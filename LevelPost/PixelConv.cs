@@ -0,0 +1,119 @@
+﻿using System;
+using System.Runtime.InteropServices;
+
+namespace LevelPost
+{
+    // Texture pixel conversions, using the SSE2/AVX2 versions from the native
+    // lzmadec library when available.
+    static class PixelConv
+    {
+        [DllImport("lzmadec")]
+        private static extern unsafe int tex_bgra_to_rgba(byte* dst, byte* scan0, int stride, int width, int height);
+        [DllImport("lzmadec")]
+        private static extern unsafe void tex_rgba_to_rgb(byte* dst, byte* src, int pixels);
+        [DllImport("lzmadec")]
+        private static extern unsafe void tex_rgb_to_rgba(byte* dst, byte* src, int pixels);
+
+        private static bool? nativeLib;
+
+        public static unsafe bool HasNativeLib
+        {
+            get
+            {
+                if (nativeLib == null)
+                {
+                    try
+                    {
+                        tex_bgra_to_rgba(null, null, 0, 0, 0);
+                        nativeLib = true;
+                    }
+                    catch (DllNotFoundException)
+                    {
+                        nativeLib = false;
+                    }
+                    catch (EntryPointNotFoundException)
+                    {
+                        nativeLib = false;
+                    }
+                    catch (BadImageFormatException)
+                    {
+                        nativeLib = false;
+                    }
+                }
+                return nativeLib.Value;
+            }
+        }
+
+        // Convert locked 32 bpp BGRA bitmap rows (row y at scan0 + y * stride) to
+        // RGBA bytes in bottom->top order, returns true if any alpha is not 255
+        public static unsafe bool BgraToRgba(IntPtr scan0, int stride, int width, int height, byte[] dst)
+        {
+            if (width < 0 || height < 0 || Math.Abs((long)stride) < width * 4L || dst.Length < (long)width * height * 4)
+                throw new ArgumentException("Invalid bitmap size");
+            byte* src = (byte*)scan0;
+            fixed (byte* dstp = dst)
+            {
+                if (HasNativeLib)
+                    return tex_bgra_to_rgba(dstp, src, stride, width, height) == 1;
+                uint all = 0xffffffff;
+                uint* d = (uint*)dstp;
+                for (int y = height - 1; y >= 0; y--)
+                {
+                    uint* s = (uint*)(src + (long)y * stride);
+                    for (int x = 0; x < width; x++)
+                    {
+                        uint p = s[x];
+                        all &= p;
+                        *d++ = (p & 0xff00ff00) | ((p >> 16) & 0xff) | ((p & 0xff) << 16);
+                    }
+                }
+                return width != 0 && height != 0 && (all >> 24) != 0xff;
+            }
+        }
+
+        // RGBA -> RGB, for opaque textures
+        public static unsafe byte[] RgbaToRgb(byte[] src, int pixels)
+        {
+            var dst = new byte[pixels * 3];
+            if (src.Length < pixels * 4L)
+                throw new ArgumentException("Invalid pixel count");
+            fixed (byte* srcp = src)
+            fixed (byte* dstp = dst)
+            {
+                if (HasNativeLib)
+                    tex_rgba_to_rgb(dstp, srcp, pixels);
+                else
+                    for (int i = 0; i < pixels; i++)
+                    {
+                        dstp[i * 3 + 0] = srcp[i * 4 + 0];
+                        dstp[i * 3 + 1] = srcp[i * 4 + 1];
+                        dstp[i * 3 + 2] = srcp[i * 4 + 2];
+                    }
+            }
+            return dst;
+        }
+
+        // RGB -> RGBA with alpha 255
+        public static unsafe byte[] RgbToRgba(byte[] src, int pixels)
+        {
+            var dst = new byte[pixels * 4];
+            if (src.Length < pixels * 3L)
+                throw new ArgumentException("Invalid pixel count");
+            fixed (byte* srcp = src)
+            fixed (byte* dstp = dst)
+            {
+                if (HasNativeLib)
+                    tex_rgb_to_rgba(dstp, srcp, pixels);
+                else
+                    for (int i = 0; i < pixels; i++)
+                    {
+                        dstp[i * 4 + 0] = srcp[i * 3 + 0];
+                        dstp[i * 4 + 1] = srcp[i * 3 + 1];
+                        dstp[i * 4 + 2] = srcp[i * 3 + 2];
+                        dstp[i * 4 + 3] = 255;
+                    }
+            }
+            return dst;
+        }
+    }
+}
@@ -0,0 +1,219 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Drawing;
+using System.Drawing.Imaging;
+using System.IO;
+using System.Security.Cryptography;
+
+namespace LevelPost
+{
+    // Decoded texture in bottom->top order, pixels are RGBA bytes as stored in
+    // CmdCreateTexture2D (Color32Array), also for RGB24
+    class TexData
+    {
+        public int width, height;
+        public bool hasAlpha;
+        public byte[] pixels;
+    }
+
+    // Decoded textures keyed by a hash of the image file contents, so an unchanged
+    // file is decoded only once. Kept in memory up to MemoryLimit bytes (least
+    // recently used dropped first) and optionally in a directory on disk.
+    static class TexCache
+    {
+        public static long MemoryLimit = 256 << 20;
+
+        public static string DefaultDir
+        {
+            get
+            {
+                return Path.Combine(Environment.GetFolderPath(Environment.SpecialFolder.LocalApplicationData),
+                    "LevelPost", "textures");
+            }
+        }
+
+        private const uint FileMagic = 0x5854504c; // LPTX
+        private const int FileVersion = 2;
+
+        private class CachedTex
+        {
+            public string key;
+            public TexData tex;
+        }
+
+        // Content key of a texture file as of its last length and write time
+        private class FileStamp
+        {
+            public long length;
+            public DateTime mtime;
+            public string key;
+        }
+
+        private static readonly object cacheLock = new object();
+        private static readonly Dictionary<string, LinkedListNode<CachedTex>> cache = new Dictionary<string, LinkedListNode<CachedTex>>();
+        private static readonly LinkedList<CachedTex> lru = new LinkedList<CachedTex>();
+        private static long cacheSize;
+        private static readonly Dictionary<string, FileStamp> stamps = new Dictionary<string, FileStamp>(StringComparer.OrdinalIgnoreCase);
+
+        // Drops the decoded textures and file stamps kept in memory, the disk cache is kept
+        public static void Clear()
+        {
+            lock (cacheLock)
+            {
+                cache.Clear();
+                lru.Clear();
+                cacheSize = 0;
+                stamps.Clear();
+            }
+        }
+
+        // Safe to call from multiple threads. cacheDir may be null for memory only.
+        public static TexData Load(string filename, string cacheDir)
+        {
+            // Unchanged files are neither read nor hashed again
+            var info = new FileInfo(filename);
+            long length = info.Length;
+            DateTime mtime = info.LastWriteTimeUtc;
+            byte[] data = null;
+            string key = null;
+            lock (cacheLock)
+                if (stamps.TryGetValue(filename, out FileStamp stamp) && stamp.length == length && stamp.mtime == mtime)
+                    key = stamp.key;
+            if (key == null)
+            {
+                using (Tracer.Begin("hash texture", length))
+                {
+                    data = File.ReadAllBytes(filename);
+                    using (var sha = SHA1.Create())
+                        key = BitConverter.ToString(sha.ComputeHash(data)).Replace("-", "");
+                }
+                lock (cacheLock)
+                    stamps[filename] = new FileStamp() { length = length, mtime = mtime, key = key };
+            }
+
+            lock (cacheLock)
+                if (cache.TryGetValue(key, out LinkedListNode<CachedTex> node))
+                {
+                    lru.Remove(node);
+                    lru.AddFirst(node);
+                    return node.Value.tex;
+                }
+
+            string cacheFile = cacheDir == null ? null : Path.Combine(cacheDir, key + ".tex");
+            TexData tex = null;
+            if (cacheFile != null)
+                using (Tracer.Begin("read texture cache"))
+                    tex = ReadCacheFile(cacheFile);
+            if (tex == null)
+            {
+                using (Tracer.Begin("decode PNG", length, Path.GetFileName(filename)))
+                {
+                    if (data == null)
+                        data = File.ReadAllBytes(filename);
+                    using (var bmp = new Bitmap(new MemoryStream(data)))
+                        tex = GetBitmapData(bmp);
+                }
+                if (cacheFile != null)
+                    using (Tracer.Begin("write texture cache", tex.pixels.Length))
+                        WriteCacheFile(cacheFile, tex);
+            }
+
+            lock (cacheLock)
+                if (!cache.ContainsKey(key))
+                {
+                    cache.Add(key, lru.AddFirst(new CachedTex() { key = key, tex = tex }));
+                    cacheSize += tex.pixels.Length;
+                    while (cacheSize > MemoryLimit && lru.Count > 1)
+                    {
+                        var last = lru.Last.Value;
+                        lru.RemoveLast();
+                        cache.Remove(last.key);
+                        cacheSize -= last.tex.pixels.Length;
+                    }
+                }
+            return tex;
+        }
+
+        private static TexData GetBitmapData(Bitmap bmp)
+        {
+            var bData = bmp.LockBits(new Rectangle(0, 0, bmp.Width, bmp.Height), ImageLockMode.ReadOnly, PixelFormat.Format32bppArgb);
+            int width = bData.Width, height = bData.Height;
+            var pixels = new byte[width * height * 4];
+            bool hasAlpha;
+            try
+            {
+                hasAlpha = PixelConv.BgraToRgba(bData.Scan0, bData.Stride, width, height, pixels);
+            }
+            finally
+            {
+                bmp.UnlockBits(bData);
+            }
+            return new TexData() { width = width, height = height, hasAlpha = hasAlpha, pixels = pixels };
+        }
+
+        // Cache file: magic, version, width, height, alpha flag, pixel byte count, pixels.
+        // Without alpha the pixels are stored as RGB to keep the file small.
+        private static TexData ReadCacheFile(string cacheFile)
+        {
+            try
+            {
+                if (!File.Exists(cacheFile))
+                    return null;
+                using (var r = new BinaryReader(File.OpenRead(cacheFile)))
+                {
+                    if (r.ReadUInt32() != FileMagic || r.ReadInt32() != FileVersion)
+                        return null;
+                    var tex = new TexData() { width = r.ReadInt32(), height = r.ReadInt32(), hasAlpha = r.ReadBoolean() };
+                    int n = r.ReadInt32();
+                    if (tex.width <= 0 || tex.height <= 0 || n != tex.width * tex.height * (tex.hasAlpha ? 4 : 3))
+                        return null;
+                    var pixels = r.ReadBytes(n);
+                    if (pixels.Length != n)
+                        return null;
+                    tex.pixels = tex.hasAlpha ? pixels : PixelConv.RgbToRgba(pixels, tex.width * tex.height);
+                    return tex;
+                }
+            }
+            catch (IOException)
+            {
+                return null;
+            }
+        }
+
+        // The disk cache is only an optimization, failing to write it is ignored
+        private static void WriteCacheFile(string cacheFile, TexData tex)
+        {
+            string tmpFile = cacheFile + "." + Guid.NewGuid().ToString("N") + ".tmp";
+            try
+            {
+                Directory.CreateDirectory(Path.GetDirectoryName(cacheFile));
+                using (var w = new BinaryWriter(File.Create(tmpFile)))
+                {
+                    w.Write(FileMagic);
+                    w.Write(FileVersion);
+                    w.Write(tex.width);
+                    w.Write(tex.height);
+                    w.Write(tex.hasAlpha);
+                    var pixels = tex.hasAlpha ? tex.pixels : PixelConv.RgbaToRgb(tex.pixels, tex.width * tex.height);
+                    w.Write(pixels.Length);
+                    w.Write(pixels);
+                }
+                if (!File.Exists(cacheFile))
+                    File.Move(tmpFile, cacheFile);
+            }
+            catch (Exception ex) when (ex is IOException || ex is UnauthorizedAccessException)
+            {
+            }
+            finally
+            {
+                try
+                {
+                    File.Delete(tmpFile);
+                }
+                catch (Exception ex) when (ex is IOException || ex is UnauthorizedAccessException)
+                {
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,265 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Globalization;
+using System.IO;
+using System.Linq;
+using System.Runtime.InteropServices;
+using System.Text;
+using System.Threading;
+
+namespace LevelPost
+{
+    // Timings of conversion and bundle reading phases, collected between Start and
+    // Stop and written as a Chrome trace (chrome://tracing, Perfetto) or a summary
+    // table. Always compiled in, when not started Begin and Add only test a flag.
+    //
+    //     using (Tracer.Begin("read level", data.Length))
+    //         ...
+    //
+    // Begin records a span with its thread, bytes processed and the bytes allocated
+    // meanwhile (by all threads, so overlapping spans share their allocations). Add
+    // only adds to the totals, for calls too frequent to trace one by one. The
+    // native library reports its LZMA and LZ4 decodes through a callback.
+    static class Tracer
+    {
+        public static string DefaultDir
+        {
+            get
+            {
+                return Path.Combine(Environment.GetFolderPath(Environment.SpecialFolder.LocalApplicationData),
+                    "LevelPost");
+            }
+        }
+
+        private struct Event
+        {
+            public string name, detail;
+            public int thread;
+            public bool native;
+            public long start, ticks, bytes, inBytes, alloc;
+        }
+
+        private class Total
+        {
+            public int count;
+            public long ticks, maxTicks, bytes, alloc;
+        }
+
+        public struct Span : IDisposable
+        {
+            private readonly string name, detail;
+            private readonly long start, bytes, alloc;
+
+            internal Span(string name, string detail, long bytes)
+            {
+                this.name = name;
+                this.detail = detail;
+                this.bytes = bytes;
+                alloc = AllocatedBytes();
+                start = Stopwatch.GetTimestamp();
+            }
+
+            public void Dispose()
+            {
+                if (name == null || !Enabled)
+                    return;
+                long end = Stopwatch.GetTimestamp();
+                Record(new Event() { name = name, detail = detail, thread = Thread.CurrentThread.ManagedThreadId,
+                    start = start, ticks = end - start, bytes = bytes,
+                    alloc = AllocatedBytes() - alloc });
+            }
+        }
+
+        private static readonly object traceLock = new object();
+        private static readonly List<Event> events = new List<Event>();
+        private static readonly Dictionary<string, Total> totals = new Dictionary<string, Total>();
+        private static long sessionStart;
+        private static int depth;
+        private static bool allocs;
+
+        public static bool Enabled { get { return Volatile.Read(ref depth) > 0; } }
+
+        // Starts collecting, the results of the previous session are dropped. Nested
+        // calls keep one session going until the last Stop.
+        public static void Start()
+        {
+            lock (traceLock)
+            {
+                if (depth++ != 0)
+                    return;
+                events.Clear();
+                totals.Clear();
+                try
+                {
+                    AppDomain.MonitoringIsEnabled = true;
+                    allocs = true;
+                }
+                catch (NotImplementedException) // Mono
+                {
+                }
+                sessionStart = Stopwatch.GetTimestamp();
+                SetNativeCallback(nativeCallback);
+            }
+        }
+
+        // Stops collecting, the results stay available until the next Start
+        public static void Stop()
+        {
+            lock (traceLock)
+            {
+                if (depth == 0 || --depth != 0)
+                    return;
+                SetNativeCallback(null);
+            }
+        }
+
+        public static Span Begin(string name, long bytes = 0, string detail = null)
+        {
+            return Enabled ? new Span(name, detail, bytes) : default(Span);
+        }
+
+        // Adds a call taking ticks (Stopwatch timestamps) to the totals for name
+        public static void Add(string name, long ticks, long bytes = 0)
+        {
+            lock (traceLock)
+                AddTotal(name, ticks, bytes, 0);
+        }
+
+        private static void Record(Event e)
+        {
+            lock (traceLock)
+            {
+                events.Add(e);
+                AddTotal(e.name, e.ticks, e.bytes, e.alloc);
+            }
+        }
+
+        private static void AddTotal(string name, long ticks, long bytes, long alloc)
+        {
+            if (!totals.TryGetValue(name, out Total t))
+                totals.Add(name, t = new Total());
+            t.count++;
+            t.ticks += ticks;
+            t.maxTicks = Math.Max(t.maxTicks, ticks);
+            t.bytes += bytes;
+            t.alloc += alloc;
+        }
+
+        private static long AllocatedBytes()
+        {
+            return allocs ? AppDomain.CurrentDomain.MonitoringTotalAllocatedMemorySize : 0;
+        }
+
+        private static double Ms(long ticks)
+        {
+            return ticks * 1000.0 / Stopwatch.Frequency;
+        }
+
+        // Totals per name, slowest first
+        public static List<string> Summary()
+        {
+            var lines = new List<string>();
+            lines.Add(string.Format(CultureInfo.InvariantCulture, "{0,-36} {1,7} {2,10} {3,9} {4,9} {5,9} {6,9}",
+                "phase", "count", "total ms", "max ms", "MB", "MB/s", "alloc MB"));
+            lock (traceLock)
+                foreach (var x in totals.OrderByDescending(x => x.Value.ticks))
+                {
+                    var t = x.Value;
+                    double mb = t.bytes / 1048576.0;
+                    lines.Add(string.Format(CultureInfo.InvariantCulture, "{0,-36} {1,7} {2,10:0.0} {3,9:0.0} {4,9:0.0} {5,9} {6,9:0.0}",
+                        x.Key, t.count, Ms(t.ticks), Ms(t.maxTicks), mb,
+                        t.bytes == 0 || t.ticks == 0 ? "" : (mb * 1000 / Ms(t.ticks)).ToString("0", CultureInfo.InvariantCulture),
+                        t.alloc / 1048576.0));
+                }
+            return lines;
+        }
+
+        // Chrome trace event format, one complete event per span
+        public static void WriteChromeTrace(string filename)
+        {
+            Event[] evs;
+            long t0;
+            lock (traceLock)
+            {
+                evs = events.ToArray();
+                t0 = sessionStart;
+            }
+            var sb = new StringBuilder("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+            for (int i = 0; i < evs.Length; i++)
+            {
+                var e = evs[i];
+                sb.Append(string.Format(CultureInfo.InvariantCulture,
+                    "{{\"name\": {0}, \"cat\": \"{1}\", \"ph\": \"X\", \"pid\": 1, \"tid\": {2}, \"ts\": {3:0.0}, \"dur\": {4:0.0}, \"args\": {{\"bytes\": {5}",
+                    JsonString(e.name), e.native ? "native" : "managed", e.thread, Ms(e.start - t0) * 1000, Ms(e.ticks) * 1000, e.bytes));
+                if (e.native)
+                    sb.Append(", \"inBytes\": ").Append(e.inBytes);
+                if (e.alloc != 0)
+                    sb.Append(", \"alloc\": ").Append(e.alloc);
+                if (e.detail != null)
+                    sb.Append(", \"detail\": ").Append(JsonString(e.detail));
+                sb.Append(i == evs.Length - 1 ? "}}\n" : "}},\n");
+            }
+            sb.Append("]}\n");
+            Directory.CreateDirectory(Path.GetDirectoryName(Path.GetFullPath(filename)));
+            File.WriteAllText(filename, sb.ToString());
+        }
+
+        private static string JsonString(string s)
+        {
+            var sb = new StringBuilder("\"");
+            foreach (char c in s)
+                if (c == '"' || c == '\\')
+                    sb.Append('\\').Append(c);
+                else if (c < ' ')
+                    sb.Append("\\u").Append(((int)c).ToString("x4"));
+                else
+                    sb.Append(c);
+            return sb.Append('"').ToString();
+        }
+
+        // Decode calls reported by lzma/trace.c
+        [UnmanagedFunctionPointer(CallingConvention.StdCall)]
+        private delegate void NativeCallback(int id, long ns, long inBytes, long outBytes);
+
+        [DllImport("lzmadec")]
+        private static extern void native_trace_set(NativeCallback callback);
+
+        private static readonly string[] nativeNames = { "native LZMA decode", "native LZ4 decode" };
+        private static readonly NativeCallback nativeCallback = OnNativeDecode; // kept alive while set
+        private static bool noNative;
+
+        private static void OnNativeDecode(int id, long ns, long inBytes, long outBytes)
+        {
+            if (!Enabled)
+                return;
+            long ticks = (long)(ns * (double)Stopwatch.Frequency / 1e9);
+            Record(new Event() { name = id >= 0 && id < nativeNames.Length ? nativeNames[id] : "native " + id,
+                thread = Thread.CurrentThread.ManagedThreadId, start = Stopwatch.GetTimestamp() - ticks, ticks = ticks,
+                bytes = outBytes, inBytes = inBytes, native = true });
+        }
+
+        // call with traceLock held
+        private static void SetNativeCallback(NativeCallback callback)
+        {
+            if (noNative)
+                return;
+            try
+            {
+                native_trace_set(callback);
+            }
+            catch (DllNotFoundException)
+            {
+                noNative = true;
+            }
+            catch (EntryPointNotFoundException)
+            {
+                noNative = true;
+            }
+            catch (BadImageFormatException)
+            {
+                noNative = true;
+            }
+        }
+    }
+}
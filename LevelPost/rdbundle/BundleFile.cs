@@ -3,9 +3,11 @@ using System.Collections.Generic;
 using System.Linq;
 using System.Text;
 using System.IO;
-using Lz4;
 using System.Diagnostics;
+using System.Threading;
+using System.Threading.Tasks;
 using AssetStudio;
+using LevelPost;
 
 // ported from https://github.com/HearthSim/UnityPack/
 namespace rdbundle
@@ -24,67 +26,128 @@ namespace rdbundle
             StandaloneLinuxUniversal = 25
         }
 
+        // threads used for decoding bundle blocks, 1 disables readahead
+        public static int DecodeThreads = Environment.ProcessorCount;
+        // decoded bytes kept per bundle
+        public static long BlockCacheSize = 64 << 20;
+        // only read the object table and names when listing materials and game objects
+        public static bool FastNames = true;
+
+        private static long decodedBytes;
+        // total uncompressed size of all decoded bundle blocks
+        public static long DecodedBytes { get { return Interlocked.Read(ref decodedBytes); } }
+
         public static void ReadBundleFile(string filename, out List<string> materials, out List<string> gameObjects)
         {
             using (var es = new EndianStream(File.OpenRead(filename), EndianType.BigEndian))
                 ReadBundleStream(es, out materials, out gameObjects);
         }
-
-        // returns list of materials
+
+        // hash from the bundle header, only reads and decompresses the blocks info
+        public static Guid ReadBundleGuid(string filename)
+        {
+            using (var es = new EndianStream(File.OpenRead(filename), EndianType.BigEndian))
+                return new Guid(ReadBlocksInfo(es).ReadBytes(16));
+        }
+
+        // reads the UnityFS header and returns the decompressed blocks info,
+        // b_Stream is left at the start of the block data
+        private static EndianStream ReadBlocksInfo(EndianStream b_Stream)
+        {
+            var header = b_Stream.ReadStringToNull();
+            if (header != "UnityFS")
+                throw new Exception("Unknown header: " +
+                    (header[0] > 'A' && header[0] < 'Z' ?
+                        header.Substring(0, 8) :
+                        string.Join(" ", header.Substring(0, 8).ToCharArray().Select(c => ((int)c).ToString("X2")))));
+            var ver1 = b_Stream.ReadInt32();
+            var ver2 = b_Stream.ReadStringToNull();
+            var ver3 = b_Stream.ReadStringToNull();
+
+            long bundleSize = ver1 < 6 ? b_Stream.ReadInt32() : b_Stream.ReadInt64();
+
+            var cHdrSize = b_Stream.ReadInt32();
+            var uHdrSize = b_Stream.ReadInt32();
+            var hdrFlags = b_Stream.ReadInt32();
+            var compression = hdrFlags & 0x3f;
+            var eofMetadata = (hdrFlags & 0x80) != 0;
+            long pos = 0;
+            if (eofMetadata) {
+                pos = b_Stream.Position;
+                b_Stream.BaseStream.Seek(-cHdrSize, SeekOrigin.End);
+            }
+            var data = decompress(b_Stream.ReadBytes(cHdrSize), uHdrSize, compression);
+            if (eofMetadata)
+                b_Stream.Position = pos;
+            return new EndianStream(new MemoryStream(data), EndianType.BigEndian);
+        }
+
+        // returns list of materials
         public static void ReadBundleStream(EndianStream b_Stream, out List<string> materials, out List<string> gameObjects)
         {
             materials = null;
             gameObjects = null;
-            var header = b_Stream.ReadStringToNull();
-            if (header == "UnityFS")
-            {
-                var ver1 = b_Stream.ReadInt32();
-                var ver2 = b_Stream.ReadStringToNull();
-                var ver3 = b_Stream.ReadStringToNull();
-
-                long bundleSize = ver1 < 6 ? b_Stream.ReadInt32() : b_Stream.ReadInt64();
-
-                var cHdrSize = b_Stream.ReadInt32();
-                var uHdrSize = b_Stream.ReadInt32();
-                var hdrFlags = b_Stream.ReadInt32();
-                var compression = hdrFlags & 0x3f;
-                var eofMetadata = (hdrFlags & 0x80) != 0;
-                long pos = 0;
-                if (eofMetadata) {
-                    pos = b_Stream.Position;
-                    b_Stream.BaseStream.Seek(-cHdrSize, SeekOrigin.End);
-                }
-                var data = decompress(b_Stream.ReadBytes(cHdrSize), uHdrSize, compression);
-                if (eofMetadata)
-                    b_Stream.Position = pos;
-                var hdr = new EndianStream(new MemoryStream(data), EndianType.BigEndian);
-                var guid = hdr.ReadBytes(16);
-                var numBlocks = hdr.ReadInt32();
-                var blocks = new BlockInfo[numBlocks];
-                for (int i = 0; i < numBlocks; i++) {
-                    var uSize = hdr.ReadInt32();
-                    var cSize = hdr.ReadInt32();
-                    var flags = hdr.ReadInt16();
-                    blocks[i] = new BlockInfo() { uSize = uSize, cSize = cSize, flags = flags};
-                }
-                var storage = new Storage(blocks, b_Stream);
-
+            var hdr = ReadBlocksInfo(b_Stream);
+            var guid = hdr.ReadBytes(16);
+            var numBlocks = hdr.ReadInt32();
+            var blocks = new BlockInfo[numBlocks];
+            for (int i = 0; i < numBlocks; i++) {
+                var uSize = hdr.ReadInt32();
+                var cSize = hdr.ReadInt32();
+                var flags = hdr.ReadInt16();
+                blocks[i] = new BlockInfo() { uSize = uSize, cSize = cSize, flags = flags};
+            }
+            using (var storage = new Storage(blocks, b_Stream)) {
+                var parts = new List<BundlePart>();
                 var numParts = hdr.ReadInt32();
                 for (int i = 0; i < numParts; i++) {
                     var ofs = hdr.ReadInt64();
                     var size = hdr.ReadInt64();
                     var status = hdr.ReadInt32();
                     var name = hdr.ReadStringToNull();
-                    var part = new BundlePart() { stream = new StreamPart(storage, ofs, size), name = name };
-                    if (i == 0) //(status & 4) != 0)
-                        LoadAssetFile(new StreamPart(storage, ofs, size), out materials, out gameObjects);
+                    // the first part is always a serialized file, resource parts only hold raw data.
+                    // The fast path reads scattered names, decoding ahead would mostly be wasted.
+                    if (i == 0 || ((status & 4) != 0 && !name.EndsWith(".resS") && !name.EndsWith(".resource")))
+                        parts.Add(new BundlePart() { stream = new StreamPart(storage, ofs, size) { ReadAhead = !FastNames }, name = name });
                 }
-            }
-            else
-                throw new Exception("Unknown header: " +
-                    (header[0] > 'A' && header[0] < 'Z' ?
-                        header.Substring(0, 8) :
-                        string.Join(" ", header.Substring(0, 8).ToCharArray().Select(c => ((int)c).ToString("X2")))));
+
+                // the parts share the block cache of storage and read it without a shared position,
+                // so the first one is parsed on this thread and the others on the thread pool
+                var results = parts.Select(part => new Task<List<string>[]>(() => LoadPart(part))).ToArray();
+                if (DecodeThreads > 1)
+                    foreach (var task in results.Skip(1))
+                        task.Start();
+                foreach (var task in results)
+                    if (task.Status == TaskStatus.Created)
+                        task.RunSynchronously();
+                try {
+                    Task.WaitAll(results);
+                } catch (AggregateException) {
+                }
+
+                foreach (var result in results) {
+                    var names = result.GetAwaiter().GetResult();
+                    if (materials == null) {
+                        materials = names[0];
+                        gameObjects = names[1];
+                    } else {
+                        materials.AddRange(names[0]);
+                        gameObjects.AddRange(names[1]);
+                    }
+                }
+            }
+        }
+
+        // materials and game objects of a serialized file part
+        private static List<string>[] LoadPart(BundlePart part)
+        {
+            List<string> materials, gameObjects;
+            if (!FastNames || !LoadAssetNames(part.stream, out materials, out gameObjects)) {
+                part.stream.ReadAhead = true;
+                part.stream.Position = 0;
+                LoadAssetFile(part.stream, out materials, out gameObjects);
+            }
+            return new[] { materials, gameObjects };
         }
 
         class FilePtr
@@ -232,6 +295,58 @@ namespace rdbundle
             //Debug.WriteLine(type);
         }
 
+        // Lists material and game object names without type trees. Only the object table
+        // and the m_Name of each material and game object are read, so just the blocks
+        // holding those are decoded. Returns false for formats or layouts it does not know.
+        static bool LoadAssetNames(Stream s, out List<string> materials, out List<string> gameObjects)
+        {
+            materials = null;
+            gameObjects = null;
+            var es = new EndianStream(s, EndianType.BigEndian);
+            var metaSize = es.ReadUInt32();
+            var fileSize = es.ReadUInt32();
+            var format = es.ReadInt32();
+            var dataOffset = es.ReadUInt32();
+            if (format < 14 || format > 21)
+                return false;
+            if (es.ReadUInt32() == 0)
+                es.endian = EndianType.LittleEndian;
+
+            var types = new TypeMeta();
+            types.Load(es, format, true);
+
+            // GameObject m_Component elements are a PPtr since 5.5, before that a pair with the class id
+            var ver = types.version.Split('.');
+            if (ver.Length < 2 || !int.TryParse(ver[0], out int major) || !int.TryParse(ver[1], out int minor))
+                return false;
+            int componentSize = major > 5 || (major == 5 && minor >= 5) ? 12 : 16;
+
+            var numObjs = es.ReadUInt32();
+            var objs = new AssetObject[numObjs];
+            for (uint i = 0; i < numObjs; i++) {
+                es.AlignStream(4);
+                objs[i] = LoadObject(es, format, types);
+            }
+            materials = new List<string>();
+            gameObjects = new List<string>();
+            foreach (var obj in objs) {
+                if (obj.ClassId != 21 && obj.ClassId != 1)
+                    continue;
+                es.Position = dataOffset + obj.DataOfs;
+                if (obj.ClassId == 1) {
+                    var numComponents = es.ReadInt32();
+                    if (numComponents < 0 || (long)numComponents * componentSize + 12 > obj.Size)
+                        return false;
+                    es.Position += numComponents * componentSize + 4; // m_Component, m_Layer
+                }
+                var nameLen = es.ReadInt32();
+                if (nameLen < 0 || nameLen > obj.Size)
+                    return false;
+                (obj.ClassId == 21 ? materials : gameObjects).Add(es.ReadAlignedString(nameLen));
+            }
+            return true;
+        }
+
         private class AssetObject
         {
             public UInt64 PathId;
@@ -314,6 +429,13 @@ namespace rdbundle
             return top;
         }
 
+        static void SkipTree(EndianStream es)
+        {
+            var numNodes = es.ReadInt32();
+            var dataSize = es.ReadInt32();
+            es.Position += (long)numNodes * 24 + dataSize;
+        }
+
         private class TypeMeta
         {
             public List<int> ClassIds;
@@ -322,7 +444,7 @@ namespace rdbundle
             public string version;
             public BuildTarget target;
 
-            public void Load(EndianStream es, int format)
+            public void Load(EndianStream es, int format, bool skipTrees = false)
             {
                 ClassIds = new List<int>();
                 Hashes = new Dictionary<int, byte[]>();
@@ -348,7 +470,9 @@ namespace rdbundle
                         }
                         ClassIds.Add(classId);
                         Hashes.Add(classId, es.ReadBytes(classId < 0 ? 32 : 16));
-                        if (hasTypeTrees)
+                        if (hasTypeTrees && skipTrees)
+                            SkipTree(es);
+                        else if (hasTypeTrees)
                             TypeTrees.Add(classId, LoadTree(es, format));
                     }
                 }
@@ -360,20 +484,141 @@ namespace rdbundle
             public int uSize, cSize, flags;
         }
 
+        // Decoded view of the bundle blocks. Block offsets are kept as prefix sums so a
+        // position maps to its block with a binary search. Decoded blocks stay in a small
+        // LRU cache, and on sequential reads the next blocks are decoded on the thread pool.
+        // ReadAt only uses the position and block of the passed cursor, so several readers
+        // can share the cache from different threads.
         private class Storage : Stream
         {
+            private class CachedBlock
+            {
+                public int index;
+                public Task<byte[]> data;
+            }
+
+            // per reader state, the last used block and whether to decode ahead of it
+            public class Cursor
+            {
+                public long curStart, curEnd;
+                public byte[] curData;
+                public int lastBlock = -1;
+                public bool readAhead = true;
+            }
+
             private BlockInfo[] blocks;
+            private long[] uOfs, cOfs;
             private EndianStream stream;
+            private object streamLock = new object();
             private long pos;
-            private long curStart, curEnd;
-            private byte[] curData;
+            private Cursor cursor = new Cursor();
             private long baseOfs;
-            
+            private Dictionary<int, LinkedListNode<CachedBlock>> cache = new Dictionary<int, LinkedListNode<CachedBlock>>();
+            private LinkedList<CachedBlock> lru = new LinkedList<CachedBlock>();
+            private long cacheSize;
+            private List<Task> pending = new List<Task>();
+            private volatile bool disposed;
+
             public Storage(BlockInfo[] blocks, EndianStream stream)
             {
                 this.blocks = blocks;
                 this.stream = stream;
                 baseOfs = stream.Position;
+                uOfs = new long[blocks.Length + 1];
+                cOfs = new long[blocks.Length + 1];
+                for (int i = 0; i < blocks.Length; i++) {
+                    uOfs[i + 1] = uOfs[i] + blocks[i].uSize;
+                    cOfs[i + 1] = cOfs[i] + blocks[i].cSize;
+                }
+            }
+
+            // last block starting at or before ofs, so empty blocks are skipped
+            private int FindBlock(long ofs)
+            {
+                if (ofs < 0 || ofs >= uOfs[blocks.Length])
+                    return -1;
+                int lo = 0, hi = blocks.Length - 1;
+                while (lo < hi) {
+                    int mid = (lo + hi + 1) >> 1;
+                    if (uOfs[mid] <= ofs)
+                        lo = mid;
+                    else
+                        hi = mid - 1;
+                }
+                return lo;
+            }
+
+            private static readonly string[] traceNames = { "bundle block", "bundle LZMA block", "bundle LZ4 block", "bundle LZ4HC block" };
+
+            private byte[] DecodeBlock(int i)
+            {
+                var blk = blocks[i];
+                int compression = blk.flags & 0x3f;
+                byte[] data;
+                Interlocked.Add(ref decodedBytes, blk.uSize);
+                using (Tracer.Begin(compression < traceNames.Length ? traceNames[compression] : "bundle block", blk.uSize)) {
+                    lock (streamLock) {
+                        if (disposed)
+                            throw new ObjectDisposedException(GetType().Name);
+                        // only hold the stream while copying the compressed data,
+                        // so other blocks can be read while this one is decoded
+                        stream.Position = baseOfs + cOfs[i];
+                        data = stream.ReadBytes(blk.cSize);
+                    }
+                    return decompress(data, blk.uSize, compression);
+                }
+            }
+
+            // call with cache locked
+            private void AddBlock(int i, Task<byte[]> task)
+            {
+                cache.Add(i, lru.AddFirst(new CachedBlock() { index = i, data = task }));
+                cacheSize += blocks[i].uSize;
+                while (cacheSize > BlockCacheSize && lru.Count > 1) {
+                    var old = lru.Last.Value;
+                    lru.RemoveLast();
+                    cache.Remove(old.index);
+                    cacheSize -= blocks[old.index].uSize;
+                }
+            }
+
+            // call with cache locked
+            private void DecodeAhead(int first)
+            {
+                pending.RemoveAll(x => x.IsCompleted);
+                int end = Math.Min(blocks.Length, first + DecodeThreads - 1);
+                for (int i = first; i < end && uOfs[i + 1] - uOfs[first] <= BlockCacheSize / 2; i++) {
+                    if (cache.ContainsKey(i))
+                        continue;
+                    int idx = i;
+                    var task = Task.Run(() => DecodeBlock(idx));
+                    AddBlock(idx, task);
+                    pending.Add(task);
+                }
+            }
+
+            private byte[] GetBlock(int i, Cursor cur)
+            {
+                Task<byte[]> task;
+                bool owner = false;
+                lock (cache) {
+                    LinkedListNode<CachedBlock> node;
+                    if (cache.TryGetValue(i, out node)) {
+                        lru.Remove(node);
+                        lru.AddFirst(node);
+                        task = node.Value.data;
+                    } else {
+                        task = new Task<byte[]>(() => DecodeBlock(i));
+                        AddBlock(i, task);
+                        owner = true;
+                    }
+                    if (cur.readAhead && i == cur.lastBlock + 1)
+                        DecodeAhead(i + 1);
+                    cur.lastBlock = i;
+                }
+                if (owner)
+                    task.RunSynchronously();
+                return task.GetAwaiter().GetResult();
             }
 
             public override long Seek(long ofs, SeekOrigin org = SeekOrigin.Begin)
@@ -395,51 +640,78 @@ namespace rdbundle
 
             public override int Read(byte[] buf, int bufOfs, int count)
             {
-                for (int left = count;;) {
-                    if (pos >= curStart && pos < curEnd) {
-                        int n = curEnd - pos < left ? (int)(curEnd - pos) : left;
-                        Array.Copy(curData, pos - curStart, buf, bufOfs, n);
-                        pos += n;
+                int n = ReadAt(cursor, pos, buf, bufOfs, count);
+                pos += n;
+                return n;
+            }
+
+            // reads at ofs without changing Position
+            public int ReadAt(Cursor cur, long ofs, byte[] buf, int bufOfs, int count)
+            {
+                for (int left = count;;) {
+                    if (ofs >= cur.curStart && ofs < cur.curEnd) {
+                        int n = cur.curEnd - ofs < left ? (int)(cur.curEnd - ofs) : left;
+                        Array.Copy(cur.curData, ofs - cur.curStart, buf, bufOfs, n);
+                        ofs += n;
                         bufOfs += n;
                         left -= n;
                         if (left == 0)
                             return count;
                     }
-                    curStart = 0;
-                    long blkOfs = 0;
-                    curData = null;
-                    for (int i = 0; i < blocks.Length; i++) {
-                        int uSize = blocks[i].uSize;
-                        if (pos < curStart + uSize) {
-                            curEnd = curStart + uSize;
-                            stream.Position = baseOfs + blkOfs;
-                            curData = decompress(stream.ReadBytes(blocks[i].cSize), uSize, blocks[i].flags & 0x3f);
-                            break;
-                        }
-                        blkOfs += blocks[i].cSize;
-                    }
-                    if (curData == null)
-                        return count - left;
+                    int i = FindBlock(ofs);
+                    if (i < 0)
+                        return count - left;
+                    cur.curData = GetBlock(i, cur);
+                    cur.curStart = uOfs[i];
+                    cur.curEnd = uOfs[i + 1];
                 }
             }
-            public override long Length { get { long len = 0; for (int i = 0; i < blocks.Length; i++) len += blocks[i].uSize; return len; } }
+
+            // waits for pending readahead, the underlying stream is owned by the caller
+            protected override void Dispose(bool disposing)
+            {
+                if (disposing && !disposed) {
+                    Task[] tasks;
+                    lock (cache) {
+                        disposed = true;
+                        tasks = pending.ToArray();
+                        pending.Clear();
+                        cache.Clear();
+                        lru.Clear();
+                        cacheSize = 0;
+                    }
+                    try {
+                        Task.WaitAll(tasks);
+                    } catch (AggregateException) {
+                    }
+                    cursor = new Cursor();
+                }
+                base.Dispose(disposing);
+            }
+
+            public override long Length { get { return uOfs[blocks.Length]; } }
             public override long Position { get { return pos; } set { Seek(value); } }
             public override bool CanSeek { get { return true; } }
             public override bool CanWrite { get { return false; } }
             public override bool CanRead { get { return true; } }
             public override void Flush() { throw new NotImplementedException(); }
-            public override void SetLength(long len) { throw new NotImplementedException(); }
+            public override void SetLength(long len) { throw new NotImplementedException(); }
             public override void Write(byte[] buf, int bufOfs, int count) { throw new NotImplementedException(); }
         }
 
+        // a file in the bundle, with its own position in the shared storage
         private class StreamPart : Stream
         {
-            private Stream baseStream;
+            private Storage baseStream;
+            private Storage.Cursor cursor = new Storage.Cursor();
             private long baseOffset;
             private long size;
             private long pos;
 
-            public StreamPart(Stream baseStream, long baseOffset, long size)
+            // decode the next blocks on sequential reads
+            public bool ReadAhead { get { return cursor.readAhead; } set { cursor.readAhead = value; } }
+
+            public StreamPart(Storage baseStream, long baseOffset, long size)
             {
                 this.baseStream = baseStream;
                 this.baseOffset = baseOffset;
@@ -470,8 +742,7 @@ namespace rdbundle
                     return 0;
                 if (count > size - pos)
                     count = (int)(size - pos);
-                baseStream.Position = pos + baseOffset;
-                int n = baseStream.Read(buf, bufOfs, count);
+                int n = baseStream.ReadAt(cursor, pos + baseOffset, buf, bufOfs, count);
                 pos += n;
                 return n;
             }
@@ -487,24 +758,14 @@ namespace rdbundle
 
         private class BundlePart
         {
-            public Stream stream;
+            public StreamPart stream;
             public string name;
         }
 
         private static void lz4decompress(byte[] src, byte[] dst)
-        {
-            using (var inputStream = new MemoryStream(src))
-            {
-                var decoder = new Lz4DecoderStream(inputStream);
-
-                for (int i = 0; ; )
-                {
-                    int nRead = decoder.Read(dst, i, dst.Length - i);
-                    if (nRead == 0)
-                        break;
-                    i += nRead;
-                }
-            }
+        {
+            if (Lz4Dec.Decode(src, src.Length, dst) != dst.Length)
+                throw new Exception("Lz4Decode: size mismatch");
         }
 
         private static byte[] decompress(byte[] data, int uSize, int compression)
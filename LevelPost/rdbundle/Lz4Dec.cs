@@ -0,0 +1,115 @@
+﻿using System;
+using System.Runtime.InteropServices;
+
+namespace rdbundle
+{
+    // LZ4 block decoder writing straight into the destination buffer.
+    // Uses lz4_decode_block from the native lzmadec library when available.
+    static class Lz4Dec
+    {
+        [DllImport("lzmadec")]
+        private static extern unsafe int lz4_decode_block(byte* dst, int dstlen, byte* src, int srclen);
+
+        private static bool? nativeLib;
+
+        public static unsafe bool HasNativeLib
+        {
+            get
+            {
+                if (nativeLib == null)
+                {
+                    try
+                    {
+                        lz4_decode_block(null, 0, null, 0);
+                        nativeLib = true;
+                    }
+                    catch (DllNotFoundException)
+                    {
+                        nativeLib = false;
+                    }
+                    catch (EntryPointNotFoundException)
+                    {
+                        nativeLib = false;
+                    }
+                    catch (BadImageFormatException)
+                    {
+                        nativeLib = false;
+                    }
+                }
+                return nativeLib.Value;
+            }
+        }
+
+        // Decode the LZ4 block in src[0..srcLen) into dst, returns the number of bytes written
+        public static unsafe int Decode(byte[] src, int srcLen, byte[] dst)
+        {
+            if (srcLen < 0 || srcLen > src.Length)
+                throw new ArgumentOutOfRangeException("srcLen");
+            int ret;
+            if (HasNativeLib)
+            {
+                fixed (byte* srcp = src)
+                fixed (byte* dstp = dst)
+                    ret = lz4_decode_block(dstp, dst.Length, srcp, srcLen);
+            }
+            else
+                ret = DecodeManaged(src, srcLen, dst);
+            if (ret < 0)
+                throw new Exception("Lz4Decode failed, corrupt data");
+            return ret;
+        }
+
+        private static int ReadLength(byte[] src, ref int ip, int srcLen, int len, int max)
+        {
+            if (len != 15)
+                return len;
+            for (int b = 255; b == 255; )
+            {
+                if (ip >= srcLen)
+                    return -1;
+                len += b = src[ip++];
+                if (len > max)
+                    return -1;
+            }
+            return len;
+        }
+
+        private static int DecodeManaged(byte[] src, int srcLen, byte[] dst)
+        {
+            int ip = 0, op = 0, dstLen = dst.Length;
+            for (;;)
+            {
+                if (ip >= srcLen)
+                    return -1;
+                int token = src[ip++];
+                int len = ReadLength(src, ref ip, srcLen, token >> 4, dstLen);
+                if (len < 0 || srcLen - ip < len || dstLen - op < len)
+                    return -1;
+                Buffer.BlockCopy(src, ip, dst, op, len);
+                ip += len;
+                op += len;
+                if (ip == srcLen) // last sequence has only literals
+                    return op;
+
+                if (srcLen - ip < 2)
+                    return -1;
+                int ofs = src[ip] | (src[ip + 1] << 8);
+                ip += 2;
+                if (ofs == 0 || ofs > op)
+                    return -1;
+                len = ReadLength(src, ref ip, srcLen, token & 15, dstLen);
+                if (len < 0 || dstLen - op < (len += 4))
+                    return -1;
+                if (ofs >= len)
+                {
+                    Buffer.BlockCopy(dst, op - ofs, dst, op, len);
+                    op += len;
+                }
+                else
+                    // overlapping copy repeats the last ofs bytes
+                    for (int m = op - ofs, end = op + len; op < end; )
+                        dst[op++] = dst[m++];
+            }
+        }
+    }
+}
@@ -1,4 +1,6 @@
 ﻿using System;
+using System.Collections.Concurrent;
+using System.IO;
 using System.Runtime.InteropServices;
 
 namespace rdbundle
@@ -14,19 +16,64 @@ namespace rdbundle
         //[DllImport("lzmadec32.dll", CallingConvention=CallingConvention.StdCall)]
         //private static extern unsafe int mydec(byte* dst, int destlen, byte* src, int srclen);
 
+        // Regular shared library built from lzma/CMakeLists.txt, used when it can be loaded
+        // (liblzmadec.so on Linux, or lzmadec.dll next to the executable)
+        [DllImport("lzmadec")]
+        private static extern IntPtr decoder_create();
+
+        [DllImport("lzmadec")]
+        private static extern unsafe int decoder_decode(IntPtr d, byte* dst, IntPtr destlen, byte* src, IntPtr srclen);
+
+        [DllImport("lzmadec")]
+        private static extern unsafe IntPtr mydec_init(byte* props, IntPtr propslen, byte* window, IntPtr windowlen);
+
+        [DllImport("lzmadec")]
+        private static extern unsafe int mydec_feed(IntPtr s, byte* dest, ref IntPtr destlen, byte* src, ref IntPtr srclen,
+            int finish, out int status);
+
+        [DllImport("lzmadec")]
+        private static extern void mydec_finish(IntPtr s);
+
+        private const int StreamChunkSize = 0x10000;
+
+        private static bool? nativeLib;
+
+        public static bool HasNativeLib
+        {
+            get
+            {
+                if (nativeLib == null)
+                {
+                    try
+                    {
+                        mydec_finish(IntPtr.Zero);
+                        nativeLib = true;
+                    }
+                    catch (DllNotFoundException)
+                    {
+                        nativeLib = false;
+                    }
+                    catch (EntryPointNotFoundException)
+                    {
+                        nativeLib = false;
+                    }
+                    catch (BadImageFormatException)
+                    {
+                        nativeLib = false;
+                    }
+                }
+                return nativeLib.Value;
+            }
+        }
+
         const uint MEM_COMMIT = 0x1000;
         const uint MEM_RESERVE = 0x2000;
-        const uint MEM_DECOMMIT = 0x4000;
         const uint PAGE_EXECUTE_READWRITE = 0x40;
 
         [DllImport("kernel32.dll", SetLastError = true)]
         static extern IntPtr VirtualAllocEx(IntPtr hProcess, IntPtr lpAddress,
         UIntPtr dwSize, uint flAllocationType, uint flProtect);
 
-        [DllImport("kernel32.dll")]
-        static extern bool VirtualFreeEx(IntPtr hProcess, IntPtr lpAddress,
-        UIntPtr dwSize, uint dwFreeType);
-
         [DllImport("kernel32.dll")]
         public static extern IntPtr GetCurrentProcess();
 
@@ -36,78 +83,150 @@ namespace rdbundle
         [DllImport("kernel32.dll", CharSet = CharSet.Auto)]
         public static extern IntPtr GetModuleHandle(string lpModuleName);
 
+        private static readonly object imageLock = new object();
+        private static FDec64 imageDec64;
+        private static FDec32 imageDec32;
+
+        // Map the embedded decoder image once, it stays mapped for the lifetime of the process
+        private static unsafe void LoadImage()
+        {
+            lock (imageLock)
+            {
+                if (imageDec64 != null || imageDec32 != null)
+                    return;
+                if (Environment.Is64BitProcess)
+                {
+                    byte[] libFile = LevelPost.Properties.Resources.lzmadec;
+                    var memSize = (UIntPtr)0x6000;
+                    var memBase = VirtualAllocEx(GetCurrentProcess(), IntPtr.Zero, memSize,
+                        MEM_RESERVE | MEM_COMMIT, PAGE_EXECUTE_READWRITE);
+                    if (memBase == (IntPtr)0)
+                        throw new System.ComponentModel.Win32Exception();
+
+                    Marshal.Copy(libFile, 0x400, memBase + 0x1000, 0x2a00); // .text
+                    Marshal.Copy(libFile, 0x2e00, memBase + 0x4000, 0x400); // .rdata
+                    Marshal.Copy(libFile, 0x3200, memBase + 0x5000, 0x200); // .pdata
+
+                    var kernel32 = GetModuleHandle("kernel32");
+                    Marshal.Copy(BitConverter.GetBytes((ulong)GetProcAddress(kernel32, "HeapFree")), 0, memBase + 0x4000, 8);
+                    Marshal.Copy(BitConverter.GetBytes((ulong)GetProcAddress(kernel32, "GetProcessHeap")), 0, memBase + 0x4008, 8);
+                    Marshal.Copy(BitConverter.GetBytes((ulong)GetProcAddress(kernel32, "HeapAlloc")), 0, memBase + 0x4010, 8);
+
+                    imageDec64 = (FDec64)Marshal.GetDelegateForFunctionPointer(memBase + 0x2550, typeof(FDec64));
+                }
+                else
+                {
+                    byte[] libFile = LevelPost.Properties.Resources.lzmadec32;
+                    var memSize = (UIntPtr)0x6000;
+                    var memBase = VirtualAllocEx(GetCurrentProcess(), IntPtr.Zero, memSize,
+                        MEM_RESERVE | MEM_COMMIT, PAGE_EXECUTE_READWRITE);
+                    if (memBase == (IntPtr)0)
+                        throw new System.ComponentModel.Win32Exception();
+
+                    Marshal.Copy(libFile, 0x400, memBase + 0x1000, 0x2c00); // .text
+                    Marshal.Copy(libFile, 0x3000, memBase + 0x4000, 0x200); // .rdata
+                    Marshal.Copy(libFile, 0x3200, memBase + 0x5000, 0x200); // .reloc
+
+                    // relocations
+                    foreach (var ofs in new int[] { 0x3af5, 0x3afc, 0x3b15, 0x3b1c, 0x3b3b, 0x3b43 })
+                        *(uint*)(memBase + ofs) += (uint)memBase - 0x10000000;
+
+                    var kernel32 = GetModuleHandle("kernel32");
+                    Marshal.Copy(BitConverter.GetBytes((uint)GetProcAddress(kernel32, "HeapFree")), 0, memBase + 0x4000, 4);
+                    Marshal.Copy(BitConverter.GetBytes((uint)GetProcAddress(kernel32, "GetProcessHeap")), 0, memBase + 0x4004, 4);
+                    Marshal.Copy(BitConverter.GetBytes((uint)GetProcAddress(kernel32, "HeapAlloc")), 0, memBase + 0x4008, 4);
+
+                    imageDec32 = (FDec32)Marshal.GetDelegateForFunctionPointer(memBase + 0x3b30, typeof(FDec32));
+                }
+            }
+        }
+
+        // Native decoder handles, each keeps its probability tables allocated between blocks
+        private static readonly ConcurrentBag<IntPtr> decoders = new ConcurrentBag<IntPtr>();
+
         public static unsafe void LzmaDecode(byte[] src, byte[] dst)
         {
-            /*
             int ret;
-            fixed (byte* srcp = src)
-            fixed (byte* dstp = dst) {
-                Debug.WriteLine(((uint)dstp + dst.Length).ToString("X"));
-                ret = mydec(dstp, dst.Length, srcp, src.Length);
-            }
-            if (ret != 0)
-                throw new Exception("LzmaDecode failed " + ret);
-            return;
-            */
-            if (Environment.Is64BitProcess)
+            if (HasNativeLib)
             {
-                byte[] libFile = LevelPost.Properties.Resources.lzmadec;
-                var memSize = (UIntPtr)0x6000;
-                var memBase = VirtualAllocEx(GetCurrentProcess(), IntPtr.Zero, memSize,
-                    MEM_RESERVE | MEM_COMMIT, PAGE_EXECUTE_READWRITE);
-                if (memBase == (IntPtr)0)
-                    throw new System.ComponentModel.Win32Exception();
-
-                Marshal.Copy(libFile, 0x400, memBase + 0x1000, 0x2a00); // .text
-                Marshal.Copy(libFile, 0x2e00, memBase + 0x4000, 0x400); // .rdata
-                Marshal.Copy(libFile, 0x3200, memBase + 0x5000, 0x200); // .pdata
-
-                var kernel32 = GetModuleHandle("kernel32");
-                Marshal.Copy(BitConverter.GetBytes((ulong)GetProcAddress(kernel32, "HeapFree")), 0, memBase + 0x4000, 8);
-                Marshal.Copy(BitConverter.GetBytes((ulong)GetProcAddress(kernel32, "GetProcessHeap")), 0, memBase + 0x4008, 8);
-                Marshal.Copy(BitConverter.GetBytes((ulong)GetProcAddress(kernel32, "HeapAlloc")), 0, memBase + 0x4010, 8);
-
-                var f = (FDec64)Marshal.GetDelegateForFunctionPointer(memBase + 0x2550, typeof(FDec64));
-                int ret;
+                if (!decoders.TryTake(out IntPtr d) && (d = decoder_create()) == IntPtr.Zero)
+                    throw new OutOfMemoryException();
                 fixed (byte* srcp = src)
                 fixed (byte* dstp = dst)
-                    ret = f(dstp, dst.Length, srcp, src.Length);
-
-                VirtualFreeEx(GetCurrentProcess(), memBase, memSize, MEM_DECOMMIT);
-                if (ret != 0)
-                    throw new Exception("LzmaDecode failed " + ret);
+                    ret = decoder_decode(d, dstp, (IntPtr)dst.Length, srcp, (IntPtr)src.Length);
+                decoders.Add(d);
             }
             else
             {
-                byte[] libFile = LevelPost.Properties.Resources.lzmadec32;
-                var memSize = (UIntPtr)0x6000;
-                var memBase = VirtualAllocEx(GetCurrentProcess(), IntPtr.Zero, memSize,
-                    MEM_RESERVE | MEM_COMMIT, PAGE_EXECUTE_READWRITE);
-                if (memBase == (IntPtr)0)
-                    throw new System.ComponentModel.Win32Exception();
-
-                Marshal.Copy(libFile, 0x400, memBase + 0x1000, 0x2c00); // .text
-                Marshal.Copy(libFile, 0x3000, memBase + 0x4000, 0x200); // .rdata
-                Marshal.Copy(libFile, 0x3200, memBase + 0x5000, 0x200); // .reloc
-
-                // relocations
-                foreach (var ofs in new int[] { 0x3af5, 0x3afc, 0x3b15, 0x3b1c, 0x3b3b, 0x3b43 })
-                    *(uint*)(memBase + ofs) += (uint)memBase - 0x10000000;
-
-                var kernel32 = GetModuleHandle("kernel32");
-                Marshal.Copy(BitConverter.GetBytes((uint)GetProcAddress(kernel32, "HeapFree")), 0, memBase + 0x4000, 4);
-                Marshal.Copy(BitConverter.GetBytes((uint)GetProcAddress(kernel32, "GetProcessHeap")), 0, memBase + 0x4004, 4);
-                Marshal.Copy(BitConverter.GetBytes((uint)GetProcAddress(kernel32, "HeapAlloc")), 0, memBase + 0x4008, 4);
-
-                var f = (FDec32)Marshal.GetDelegateForFunctionPointer(memBase + 0x3b30, typeof(FDec32));
-                int ret;
+                LoadImage();
                 fixed (byte* srcp = src)
                 fixed (byte* dstp = dst)
-                    ret = f(dstp, dst.Length, srcp, src.Length);
+                    ret = imageDec64 != null ?
+                        imageDec64(dstp, dst.Length, srcp, src.Length) :
+                        imageDec32(dstp, dst.Length, srcp, src.Length);
+            }
+            if (ret != 0)
+                throw new Exception("LzmaDecode failed " + ret);
+        }
+
+        private static byte[] ReadExact(Stream s, int n)
+        {
+            var buf = new byte[n];
+            for (int i = 0, r; i < n; i += r)
+                if ((r = s.Read(buf, i, n - i)) <= 0)
+                    throw new Exception("LzmaDecode: unexpected end of input");
+            return buf;
+        }
 
-                VirtualFreeEx(GetCurrentProcess(), memBase, memSize, MEM_DECOMMIT);
-                if (ret != 0)
-                    throw new Exception("LzmaDecode failed " + ret);
+        // Decode srcLen bytes of LZMA data (5 byte props header first) from src straight into dst.
+        // With the native library the compressed data is read and decoded in chunks. The decoder
+        // state is set up for every call, bundle blocks use the pooled decoders of the overload above.
+        public static unsafe void LzmaDecode(Stream src, long srcLen, byte[] dst)
+        {
+            if (!HasNativeLib)
+            {
+                LzmaDecode(ReadExact(src, (int)srcLen), dst);
+                return;
+            }
+            if (srcLen < 5)
+                throw new Exception("LzmaDecode: unexpected end of input");
+            var props = ReadExact(src, 5);
+            long left = srcLen - 5;
+            var buf = new byte[Math.Min(left, StreamChunkSize)];
+            fixed (byte* propsp = props)
+            fixed (byte* dstp = dst)
+            fixed (byte* bufp = buf)
+            {
+                IntPtr s = mydec_init(propsp, (IntPtr)props.Length, dstp, (IntPtr)dst.Length);
+                if (s == IntPtr.Zero)
+                    throw new Exception("LzmaDecode init failed");
+                try
+                {
+                    int bufPos = 0, bufLen = 0, dstPos = 0;
+                    while (dstPos < dst.Length)
+                    {
+                        if (bufPos == bufLen && left != 0)
+                        {
+                            bufLen = src.Read(buf, 0, (int)Math.Min(left, buf.Length));
+                            if (bufLen <= 0)
+                                throw new Exception("LzmaDecode: unexpected end of input");
+                            left -= bufLen;
+                            bufPos = 0;
+                        }
+                        IntPtr inLen = (IntPtr)(bufLen - bufPos), outLen = IntPtr.Zero;
+                        int ret = mydec_feed(s, null, ref outLen, bufp + bufPos, ref inLen, left == 0 ? 1 : 0, out int status);
+                        if (ret != 0)
+                            throw new Exception("LzmaDecode failed " + ret);
+                        if ((int)inLen == 0 && (int)outLen == 0)
+                            throw new Exception("LzmaDecode: truncated data");
+                        bufPos += (int)inLen;
+                        dstPos += (int)outLen;
+                    }
+                }
+                finally
+                {
+                    mydec_finish(s);
+                }
             }
         }
     }
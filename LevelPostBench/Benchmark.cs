@@ -0,0 +1,123 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Linq;
+using System.Reflection;
+
+namespace LevelPostBench
+{
+    class Benchmark
+    {
+        public string name;
+        public Action setup; // before every run, not timed
+        public Func<long> run; // returns the bytes processed
+    }
+
+    class BenchResult
+    {
+        public string name;
+        public int runs;
+        public double minMs, medianMs, maxMs;
+        public long bytes;
+        public double allocBytes = -1; // per run, -1 when not available
+        public double gen0, gen2; // collections per run
+        public string error;
+        public double MBPerSec { get { return medianMs > 0 ? bytes / 1e6 / (medianMs / 1e3) : 0; } }
+    }
+
+    // Allocated bytes of the process. GC.GetTotalAllocatedBytes is not in .NET Framework
+    // 4.7.2 but is on newer runtimes, AppDomain monitoring is not implemented by Mono.
+    static class Allocs
+    {
+        public static readonly string Source;
+        private static readonly Func<long> total = Init(out Source);
+
+        private static Func<long> Init(out string source)
+        {
+            var method = typeof(GC).GetMethod("GetTotalAllocatedBytes", BindingFlags.Public | BindingFlags.Static,
+                null, new[] { typeof(bool) }, null);
+            if (method != null)
+            {
+                var f = (Func<bool, long>)Delegate.CreateDelegate(typeof(Func<bool, long>), method);
+                source = "GC.GetTotalAllocatedBytes";
+                return () => f(true);
+            }
+            try
+            {
+                AppDomain.MonitoringIsEnabled = true;
+                source = "AppDomain monitoring";
+                return () => AppDomain.CurrentDomain.MonitoringTotalAllocatedMemorySize;
+            }
+            catch (NotImplementedException)
+            {
+            }
+            method = typeof(GC).GetMethod("GetAllocatedBytesForCurrentThread", BindingFlags.Public | BindingFlags.Static);
+            if (method != null)
+            {
+                source = "GC.GetAllocatedBytesForCurrentThread (main thread only)";
+                return (Func<long>)Delegate.CreateDelegate(typeof(Func<long>), method);
+            }
+            source = "not available";
+            return null;
+        }
+
+        public static bool Available { get { return total != null; } }
+
+        public static long Total { get { return total != null ? total() : 0; } }
+    }
+
+    static class BenchRunner
+    {
+        private static double Median(List<double> v)
+        {
+            v.Sort();
+            int n = v.Count;
+            return n % 2 == 1 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+        }
+
+        // One untimed warmup run, then runs timed runs. Collects before each run so
+        // earlier garbage is not charged to it.
+        public static BenchResult Run(Benchmark b, int runs)
+        {
+            var res = new BenchResult { name = b.name, runs = runs };
+            var times = new List<double>();
+            long allocs = 0;
+            int gen0 = 0, gen2 = 0;
+            try
+            {
+                for (int i = -1; i < runs; i++)
+                {
+                    b.setup?.Invoke();
+                    GC.Collect();
+                    GC.WaitForPendingFinalizers();
+                    GC.Collect();
+                    int c0 = GC.CollectionCount(0), c2 = GC.CollectionCount(2);
+                    long a = Allocs.Total;
+                    var sw = Stopwatch.StartNew();
+                    long bytes = b.run();
+                    sw.Stop();
+                    if (i < 0)
+                        continue;
+                    allocs += Allocs.Total - a;
+                    gen0 += GC.CollectionCount(0) - c0;
+                    gen2 += GC.CollectionCount(2) - c2;
+                    times.Add(sw.Elapsed.TotalMilliseconds);
+                    res.bytes = bytes;
+                }
+            }
+            catch (Exception ex)
+            {
+                res.error = ex.GetType().Name + ": " + ex.Message;
+                return res;
+            }
+            res.minMs = times.Min();
+            res.maxMs = times.Max();
+            res.medianMs = Median(times);
+            if (Allocs.Available)
+                res.allocBytes = (double)allocs / runs;
+            res.gen0 = (double)gen0 / runs;
+            res.gen2 = (double)gen2 / runs;
+            return res;
+        }
+    }
+}
@@ -0,0 +1,389 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Runtime.InteropServices;
+using LevelPost;
+using rdbundle;
+
+namespace LevelPostBench
+{
+    // Generates the inputs in a work directory and lists the benchmarks on them:
+    //
+    //   level/bench.overload             the level, converted from a copy
+    //   textures/bench_tex_N.png         textures for the even materials
+    //   bundles/windows/bench            bundle with the odd materials and the entities
+    //   scan/windows/bench_N             copies of the bundle for the scan
+    class Suite
+    {
+        public LevelOptions level = new LevelOptions();
+        public BundleOptions bundle = new BundleOptions();
+        public int scanBundles = 8;
+        public int decodeBytes = 8 << 20; // data for the LZMA and LZ4 decoder benchmarks
+        public bool lzma = true; // whether LZMA can be decoded here
+
+        private string dir, levelFile, texDir, bundleFile, scanDir, indexFile;
+        private long levelSize, bundleSize;
+        private string[] textures;
+        private ConvertBundle convertBundle;
+        private byte[] decodeData, lzmaData;
+        private byte[][] lz4Blocks, lzmaBlocks;
+        private byte[] texPixels;
+        private const int TexSize = 1024;
+
+        private static string Dir(params string[] parts)
+        {
+            var path = Path.Combine(parts);
+            Directory.CreateDirectory(path);
+            return path;
+        }
+
+        private static string MB(long bytes)
+        {
+            return (bytes / 1e6).ToString("0.0") + " MB";
+        }
+
+        // decodeData cut in blockSize pieces, each compressed with encode(ofs, count)
+        private byte[][] Blocks(int blockSize, Func<int, int, byte[]> encode)
+        {
+            var blocks = new byte[(decodeData.Length + blockSize - 1) / blockSize][];
+            for (int i = 0; i < blocks.Length; i++)
+                blocks[i] = encode(i * blockSize, Math.Min(blockSize, decodeData.Length - i * blockSize));
+            return blocks;
+        }
+
+        public void Generate(string workDir, Action<string> log)
+        {
+            dir = workDir;
+            levelFile = Path.Combine(Dir(dir, "level"), "bench.overload");
+            LevelFile.WriteLevel(levelFile, LevelGen.Generate(level));
+            levelSize = new FileInfo(levelFile).Length;
+
+            texDir = Dir(dir, "textures");
+            foreach (var f in Directory.GetFiles(texDir))
+                File.Delete(f);
+            long texSize = LevelGen.WriteTextures(texDir, level);
+            textures = Directory.GetFiles(texDir, "*.png");
+            log("level " + MB(levelSize) + ", " + level.meshes + " meshes of " + level.verts + " vertices, " +
+                level.materials + " materials, " + level.entities + " entities, " + textures.Length + " textures " + MB(texSize));
+
+            // the scan copies get their own header guid, otherwise they are only read once
+            bundleFile = Path.Combine(Dir(dir, "bundles", "windows"), "bench");
+            scanDir = Dir(dir, "scan");
+            var scanFiles = Dir(scanDir, "windows");
+            foreach (var f in Directory.GetFiles(scanFiles))
+                File.Delete(f);
+            BundleGen.Write(new[] { bundleFile }.Concat(Enumerable.Range(0, scanBundles).Select(i =>
+                Path.Combine(scanFiles, "bench_" + i))).ToList(), bundle);
+            bundleSize = new FileInfo(bundleFile).Length;
+            var names = new[] { "none", "LZMA", "LZ4" };
+            log("bundle " + MB(bundleSize) + ", " + bundle.materials + " materials, " + bundle.entities + " entities in " + bundle.assetFiles + " serialized files, " +
+                (bundle.blockSize >> 10) + " KB blocks " + string.Join("/", bundle.compressions.Select(x => names[x])) +
+                ", blocks info " + names[bundle.infoCompression] + (bundle.eofMetadata ? " at the end" : " after the header"));
+
+            var bundleFiles = new BundleFiles() { Logger = log };
+            var info = bundleFiles.CachedBundleInfo(bundleFile);
+            if (info.materials.Count != bundle.materials || info.gameObjects.Count(x => x.StartsWith("entity_")) != bundle.entities)
+                throw new Exception("Generated bundle reads back as " + info.materials.Count + " materials and " +
+                    info.gameObjects.Count + " game objects");
+            convertBundle = ConvertBundle.FromInfo(bundleFile, info);
+
+            indexFile = Path.Combine(dir, "bundles.idx");
+            var scanned = new BundleFiles() { Logger = log };
+            scanned.ScanBundles(scanDir);
+            scanned.SaveIndex(indexFile);
+
+            // whole blocks like in LZMA bundles, 128 KB blocks like in LZ4 bundles
+            var contents = BundleGen.Contents(bundle, out int[] partSizes);
+            decodeData = new byte[Math.Min(decodeBytes, contents.Length)];
+            Buffer.BlockCopy(contents, 0, decodeData, 0, decodeData.Length);
+            if (lzma)
+            {
+                lzmaData = LzmaEnc.Encode(decodeData, 0, decodeData.Length);
+                lzmaBlocks = Blocks(bundle.blockSize, (ofs, count) => LzmaEnc.Encode(decodeData, ofs, count));
+            }
+            lz4Blocks = Blocks(1 << 17, (ofs, count) => Lz4Enc.Encode(decodeData, ofs, count));
+            log("decoder data " + MB(decodeData.Length) + (lzma ? ", LZMA " + MB(lzmaData.Length) + ", LZMA in " +
+                lzmaBlocks.Length + " bundle blocks " + MB(lzmaBlocks.Sum(x => (long)x.Length)) : "") +
+                ", LZ4 " + MB(lz4Blocks.Sum(x => (long)x.Length)));
+
+            texPixels = new byte[TexSize * TexSize * 4];
+            var rnd = new Random(level.seed);
+            for (int p = 0; p < texPixels.Length; p += 4)
+            {
+                int x = (p >> 2) % TexSize, y = (p >> 2) / TexSize, n = rnd.Next(32);
+                texPixels[p] = (byte)(x / 4 + n);
+                texPixels[p + 1] = (byte)(y / 4 + n);
+                texPixels[p + 2] = (byte)((x ^ y) + n);
+                texPixels[p + 3] = (byte)(255 - n);
+            }
+        }
+
+        private ConvertSettings Settings(string incrementalDir)
+        {
+            var settings = new ConvertSettings()
+            {
+                texDirs = new List<string>() { texDir },
+                ignoreTexDirs = new List<string>(),
+                texPointPx = 32,
+                probeRes = 256,
+                incrementalDir = incrementalDir
+            };
+            settings.bundles.Add(convertBundle);
+            return settings;
+        }
+
+        private Benchmark Convert(string name, bool streaming, string incrementalDir)
+        {
+            var file = Path.Combine(Dir(dir, "out"), "convert.overload");
+            return new Benchmark()
+            {
+                name = name,
+                setup = () => File.Copy(levelFile, file, true),
+                run = () => {
+                    bool prev = LevelConvert.Streaming;
+                    LevelConvert.Streaming = streaming;
+                    try
+                    {
+                        var stats = LevelConvert.Convert(file, Settings(incrementalDir), msg => { });
+                        if (stats.convertedTextures == 0 || stats.convertedEntities == 0)
+                            throw new Exception("nothing converted");
+                    }
+                    finally
+                    {
+                        LevelConvert.Streaming = prev;
+                    }
+                    return levelSize;
+                }
+            };
+        }
+
+        // scanBundles bundles with the material and entity counts of the bench bundle, every
+        // tenth name is also in the next bundle
+        private List<ConvertBundle> IndexBundles()
+        {
+            var bundles = new List<ConvertBundle>();
+            for (int b = 0; b < scanBundles; b++)
+            {
+                var bun = new ConvertBundle() { Dir = "bundles", OS = "windows", Name = "bench_" + b,
+                    Materials = new Dictionary<string, string>(StringComparer.OrdinalIgnoreCase),
+                    GameObjects = new HashSet<string>(StringComparer.OrdinalIgnoreCase) };
+                for (int i = 0; i < bundle.materials; i++)
+                {
+                    var mat = "Bench_Mat_" + (i % 10 == 0 && b > 0 ? b - 1 : b) + "_" + i;
+                    bun.Materials[mat.ToLowerInvariant()] = mat;
+                }
+                for (int i = 0; i < bundle.entities; i++)
+                    bun.GameObjects.Add("entity_bench_" + (i % 10 == 0 && b > 0 ? b - 1 : b) + "_" + i);
+                bundles.Add(bun);
+            }
+            return bundles;
+        }
+
+        // Looks up every name of the bundles in upper case, like the level refers to them
+        private Benchmark IndexLookup(string name, Func<List<ConvertBundle>, BunRef> create)
+        {
+            List<ConvertBundle> bundles = null;
+            return new Benchmark()
+            {
+                name = name,
+                setup = () => {
+                    if (bundles == null)
+                        bundles = IndexBundles();
+                },
+                run = () => {
+                    var bunRef = create(bundles);
+                    long bytes = 0;
+                    foreach (var bun in bundles)
+                    {
+                        foreach (var mat in bun.Materials.Values)
+                            if (bunRef.TryGetMaterial(mat.ToUpperInvariant(), out string newName, out ConvertBundle found))
+                                bytes += newName.Length;
+                        foreach (var go in bun.GameObjects)
+                            if (bunRef.TryGetGameObject(go.ToUpperInvariant(), out ConvertBundle found))
+                                bytes += go.Length;
+                    }
+                    return bytes;
+                }
+            };
+        }
+
+        private Benchmark ReadBundle(string name, bool fastNames, int threads)
+        {
+            return new Benchmark()
+            {
+                name = name,
+                run = () => {
+                    bool prevNames = BundleFile.FastNames;
+                    int prevThreads = BundleFile.DecodeThreads;
+                    BundleFile.FastNames = fastNames;
+                    BundleFile.DecodeThreads = threads;
+                    try
+                    {
+                        BundleFile.ReadBundleFile(bundleFile, out List<string> materials, out List<string> gameObjects);
+                        if (materials.Count != bundle.materials || gameObjects.Count != bundle.entities * 3)
+                            throw new Exception("read " + materials.Count + " materials and " + gameObjects.Count + " game objects");
+                    }
+                    finally
+                    {
+                        BundleFile.FastNames = prevNames;
+                        BundleFile.DecodeThreads = prevThreads;
+                    }
+                    return bundleSize;
+                }
+            };
+        }
+
+        private Benchmark Scan(string name, bool useIndex)
+        {
+            return new Benchmark()
+            {
+                name = name,
+                run = () => {
+                    var bundleFiles = new BundleFiles() { Logger = msg => { } };
+                    if (useIndex)
+                        bundleFiles.LoadIndex(indexFile);
+                    bundleFiles.ScanBundles(scanDir);
+                    if (bundleFiles.Bundles.Count != scanBundles)
+                        throw new Exception("found " + bundleFiles.Bundles.Count + " bundles");
+                    return bundleSize * scanBundles;
+                }
+            };
+        }
+
+        // Loads all level textures through TexCache. Cold runs start without the textures
+        // and file stamps in memory, so each file is hashed again and then decoded or read
+        // from the disk cache.
+        private Benchmark LoadTextures(string name, bool cold, string cacheDir)
+        {
+            return new Benchmark()
+            {
+                name = name,
+                setup = () => {
+                    if (cold)
+                        TexCache.Clear();
+                },
+                run = () => {
+                    long total = 0;
+                    foreach (var texture in textures)
+                        total += TexCache.Load(texture, cacheDir).pixels.Length;
+                    return total;
+                }
+            };
+        }
+
+        public List<Benchmark> Benchmarks()
+        {
+            var list = new List<Benchmark>();
+            var outFile = Path.Combine(Dir(dir, "out"), "write.overload");
+            Level loaded = null;
+
+            list.Add(new Benchmark() { name = "level read", run = () => {
+                LevelFile.ReadLevel(levelFile);
+                return levelSize;
+            } });
+            list.Add(new Benchmark() { name = "level scan", run = () => {
+                LevelFile.LazyLevel.Open(levelFile);
+                return levelSize;
+            } });
+            list.Add(new Benchmark() { name = "level dump", run = () => {
+                LevelDump.DumpLines(levelFile);
+                return levelSize;
+            } });
+            list.Add(new Benchmark() { name = "level write",
+                setup = () => {
+                    if (loaded == null)
+                        loaded = LevelFile.ReadLevel(levelFile);
+                },
+                run = () => {
+                    LevelFile.WriteLevel(outFile, loaded);
+                    return new FileInfo(outFile).Length;
+                } });
+            list.Add(Convert("level convert", true, null));
+            list.Add(Convert("level convert loaded", false, null));
+            list.Add(Convert("level convert incremental", true, Dir(dir, "incremental")));
+            foreach (var ext in new[] { "obj", "ply" })
+            {
+                var exportFile = Path.Combine(Dir(dir, "out"), "export." + ext);
+                list.Add(new Benchmark() { name = "level export " + ext, run = () => {
+                    LevelSaveObj.SaveObj(levelFile, exportFile, msg => { });
+                    return new FileInfo(exportFile).Length;
+                } });
+            }
+
+            // with one thread the serialized files of the bundle are read one after the other
+            list.Add(ReadBundle("bundle read names", true, Environment.ProcessorCount));
+            list.Add(ReadBundle("bundle read names 1 thread", true, 1));
+            list.Add(ReadBundle("bundle read full", false, Environment.ProcessorCount));
+            foreach (var threads in new[] { 1, 2, 4, 8 })
+                list.Add(ReadBundle("bundle read full " + threads + (threads == 1 ? " thread" : " threads"), false, threads));
+            list.Add(Scan("bundle scan", false));
+            list.Add(Scan("bundle scan indexed", true));
+            list.Add(IndexLookup("bundle index lookup", bundles => {
+                var bunRef = new BunRef();
+                bunRef.Init(new ConvertSettings() { bundles = bundles });
+                return bunRef;
+            }));
+
+            var dst = new byte[decodeData.Length];
+            if (lzma)
+            {
+                list.Add(new Benchmark() { name = "LZMA decode", run = () => {
+                    LzmaDec.LzmaDecode(lzmaData, dst);
+                    return dst.Length;
+                } });
+                list.Add(new Benchmark() { name = "LZMA decode stream", run = () => {
+                    LzmaDec.LzmaDecode(new MemoryStream(lzmaData), lzmaData.Length, dst);
+                    return dst.Length;
+                } });
+                // per bundle block like BundleFile, divide by the block count from the log for the latency
+                var blockDst = Enumerable.Range(0, lzmaBlocks.Length).Select(i =>
+                    new byte[Math.Min(bundle.blockSize, decodeData.Length - i * bundle.blockSize)]).ToArray();
+                list.Add(new Benchmark() { name = "LZMA decode blocks", run = () => {
+                    for (int i = 0; i < lzmaBlocks.Length; i++)
+                        LzmaDec.LzmaDecode(lzmaBlocks[i], blockDst[i]);
+                    return decodeData.Length;
+                } });
+                list.Add(new Benchmark() { name = "LZMA decode blocks stream", run = () => {
+                    for (int i = 0; i < lzmaBlocks.Length; i++)
+                        LzmaDec.LzmaDecode(new MemoryStream(lzmaBlocks[i]), lzmaBlocks[i].Length, blockDst[i]);
+                    return decodeData.Length;
+                } });
+            }
+            // per block, like BundleFile.lz4decompress
+            var block = new byte[1 << 17];
+            list.Add(new Benchmark() { name = "LZ4 decode", run = () => {
+                long total = 0;
+                foreach (var src in lz4Blocks)
+                    total += Lz4Dec.Decode(src, src.Length, block);
+                return total;
+            } });
+            list.Add(new Benchmark() { name = "LZ4 decode stream (old)", run = () => {
+                long total = 0;
+                foreach (var src in lz4Blocks)
+                    using (var s = new Lz4.Lz4DecoderStream(new MemoryStream(src)))
+                        for (int n; (n = s.Read(block, 0, block.Length)) > 0; )
+                            total += n;
+                return total;
+            } });
+
+            list.Add(LoadTextures("texture decode", true, null));
+            list.Add(LoadTextures("texture cache disk", true, Dir(dir, "texcache")));
+            list.Add(LoadTextures("texture cache memory", false, null));
+            var rgba = new byte[texPixels.Length];
+            list.Add(new Benchmark() { name = "pixel swizzle", run = () => {
+                var h = GCHandle.Alloc(texPixels, GCHandleType.Pinned);
+                try
+                {
+                    PixelConv.BgraToRgba(h.AddrOfPinnedObject(), TexSize * 4, TexSize, TexSize, rgba);
+                }
+                finally
+                {
+                    h.Free();
+                }
+                return rgba.Length;
+            } });
+            return list;
+        }
+    }
+}
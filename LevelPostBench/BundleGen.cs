@@ -0,0 +1,395 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Text;
+
+namespace LevelPostBench
+{
+    class BundleOptions
+    {
+        public int materials = 200; // bench_mat_N
+        public int entities = LevelGen.Prefabs; // entity_bench_N game objects, each with two child objects
+        public int meshBytes = 8 << 20; // mesh objects in the serialized file
+        public int textureBytes = 16 << 20; // the .resS part
+        public int assetFiles = 2; // serialized files, the objects are dealt out over them
+        public int blockSize = 128 << 10;
+        public int[] compressions = { 2, 1, 0 }; // per block, repeated: 0 none, 1 LZMA, 2 LZ4
+        public int infoCompression = 2;
+        public bool eofMetadata = true;
+        public int seed = 1;
+    }
+
+    // Synthetic UnityFS bundle (version 6, like Unity 2017) with assetFiles serialized
+    // files (format 17, with type trees) and a .resS part. The serialized files hold the
+    // materials, the entity game objects and mesh objects in a shuffled order, so the
+    // names are spread over the blocks like in a real bundle. The data is cut in
+    // blockSize blocks compressed with compressions in turn.
+    static class BundleGen
+    {
+        private const string UnityVersion = "2017.4.21f1";
+        private const int Format = 17;
+
+        private class Node
+        {
+            public int depth, size, flags;
+            public string type, name;
+            public bool isArray;
+        }
+
+        private class TypeInfo
+        {
+            public int classId;
+            public Node[] tree;
+        }
+
+        private static Node N(int depth, string type, string name, int size, int flags = 0, bool isArray = false)
+        {
+            return new Node { depth = depth, type = type, name = name, size = size, flags = flags, isArray = isArray };
+        }
+
+        private static Node[] StringNodes(int depth, string name)
+        {
+            return new[] {
+                N(depth, "string", name, -1),
+                N(depth + 1, "Array", "Array", -1, 0x4000, true),
+                N(depth + 2, "int", "size", 4),
+                N(depth + 2, "char", "data", 1)
+            };
+        }
+
+        private static Node[] PPtrNodes(int depth, string type, string name)
+        {
+            return new[] {
+                N(depth, "PPtr<" + type + ">", name, 12),
+                N(depth + 1, "int", "m_FileID", 4),
+                N(depth + 1, "SInt64", "m_PathID", 8)
+            };
+        }
+
+        private static readonly TypeInfo[] types = {
+            new TypeInfo { classId = 1, tree = new[] {
+                    N(0, "GameObject", "Base", -1),
+                    N(1, "vector", "m_Component", -1),
+                    N(2, "Array", "Array", -1, 0, true),
+                    N(3, "int", "size", 4),
+                    N(3, "ComponentPair", "data", 12) }
+                .Concat(PPtrNodes(4, "Component", "component"))
+                .Concat(new[] { N(1, "unsigned int", "m_Layer", 4) })
+                .Concat(StringNodes(1, "m_Name"))
+                .Concat(new[] { N(1, "UInt16", "m_Tag", 2), N(1, "bool", "m_IsActive", 1, 0x4000) }).ToArray() },
+            new TypeInfo { classId = 21, tree = new[] { N(0, "Material", "Base", -1) }
+                .Concat(StringNodes(1, "m_Name"))
+                .Concat(PPtrNodes(1, "Shader", "m_Shader"))
+                .Concat(new[] {
+                    N(1, "TypelessData", "m_SavedProperties", -1),
+                    N(2, "Array", "Array", -1, 0x4000, true),
+                    N(3, "int", "size", 4),
+                    N(3, "UInt8", "data", 1) }).ToArray() },
+            new TypeInfo { classId = 43, tree = new[] { N(0, "Mesh", "Base", -1) }
+                .Concat(StringNodes(1, "m_Name"))
+                .Concat(new[] {
+                    N(1, "TypelessData", "m_VertexData", -1),
+                    N(2, "Array", "Array", -1, 0x4000, true),
+                    N(3, "int", "size", 4),
+                    N(3, "UInt8", "data", 1) }).ToArray() }
+        };
+
+        private class Obj
+        {
+            public long pathId;
+            public int type; // index in types
+            public byte[] data;
+        }
+
+        private static void WriteBE(Stream s, long v, int bytes)
+        {
+            for (int i = bytes - 1; i >= 0; i--)
+                s.WriteByte((byte)(v >> (i * 8)));
+        }
+
+        private static void WriteCString(Stream s, string str)
+        {
+            var b = Encoding.UTF8.GetBytes(str);
+            s.Write(b, 0, b.Length);
+            s.WriteByte(0);
+        }
+
+        private static void Align(BinaryWriter w, int alignment, long baseOfs = 0)
+        {
+            while ((baseOfs + w.BaseStream.Position) % alignment != 0)
+                w.Write((byte)0);
+        }
+
+        private static void WriteAlignedString(BinaryWriter w, string str)
+        {
+            var b = Encoding.UTF8.GetBytes(str);
+            w.Write(b.Length);
+            w.Write(b);
+            Align(w, 4);
+        }
+
+        private static void WriteTree(BinaryWriter w, Node[] tree)
+        {
+            var strings = new MemoryStream();
+            var ofs = new Dictionary<string, int>();
+            Func<string, int> str = s => {
+                if (!ofs.TryGetValue(s, out int o))
+                {
+                    ofs.Add(s, o = (int)strings.Length);
+                    WriteCString(strings, s);
+                }
+                return o;
+            };
+            var nodes = new MemoryStream();
+            var nw = new BinaryWriter(nodes);
+            for (int i = 0; i < tree.Length; i++)
+            {
+                var n = tree[i];
+                nw.Write((ushort)1);
+                nw.Write((byte)n.depth);
+                nw.Write((byte)(n.isArray ? 1 : 0));
+                nw.Write(str(n.type));
+                nw.Write(str(n.name));
+                nw.Write(n.size);
+                nw.Write(i);
+                nw.Write(n.flags);
+            }
+            w.Write(tree.Length);
+            w.Write((int)strings.Length);
+            w.Write(nodes.ToArray());
+            w.Write(strings.ToArray());
+        }
+
+        private static byte[] ObjectData(Action<BinaryWriter> write)
+        {
+            var s = new MemoryStream();
+            using (var w = new BinaryWriter(s))
+                write(w);
+            return s.ToArray();
+        }
+
+        private static byte[] GameObject(Random rnd, string name, int components)
+        {
+            return ObjectData(w => {
+                w.Write(components);
+                for (int i = 0; i < components; i++)
+                {
+                    w.Write(0);
+                    w.Write((long)rnd.Next());
+                }
+                w.Write(0); // m_Layer
+                WriteAlignedString(w, name);
+                w.Write((ushort)0);
+                w.Write(true);
+                Align(w, 4);
+            });
+        }
+
+        private static byte[] Material(Random rnd, string name)
+        {
+            return ObjectData(w => {
+                WriteAlignedString(w, name);
+                w.Write(0);
+                w.Write((long)rnd.Next());
+                w.Write(64);
+                for (int i = 0; i < 16; i++)
+                    w.Write(i < 12 ? 1f : (float)rnd.NextDouble());
+            });
+        }
+
+        // vertex data like floats, mostly compressible
+        private static byte[] Mesh(Random rnd, string name, int size)
+        {
+            return ObjectData(w => {
+                WriteAlignedString(w, name);
+                int floats = size / 4;
+                w.Write(floats * 4);
+                for (int i = 0; i < floats; i++)
+                    w.Write((i % 3 == 1 ? 0 : i / 3 % 64) + rnd.Next(8) / 8f);
+                Align(w, 4);
+            });
+        }
+
+        // every assetFiles-th material, entity and mesh starting at the index-th
+        private static byte[] SerializedFile(BundleOptions o, Random rnd, int index)
+        {
+            var objs = new List<Obj>();
+            for (int i = index; i < o.materials; i += o.assetFiles)
+                objs.Add(new Obj { type = 1, data = Material(rnd, "bench_mat_" + i) });
+            for (int i = index; i < o.entities; i += o.assetFiles)
+            {
+                objs.Add(new Obj { type = 0, data = GameObject(rnd, LevelGen.EntityName(i), 4) });
+                objs.Add(new Obj { type = 0, data = GameObject(rnd, "model", 3) });
+                objs.Add(new Obj { type = 0, data = GameObject(rnd, "collider", 2) });
+            }
+            const int meshSize = 64 << 10;
+            for (int i = index; i * meshSize < o.meshBytes; i += o.assetFiles)
+                objs.Add(new Obj { type = 2, data = Mesh(rnd, "mesh_" + i, Math.Min(meshSize, o.meshBytes - i * meshSize)) });
+            foreach (var obj in objs)
+                obj.pathId = ((long)rnd.Next() << 31) | (uint)rnd.Next();
+            objs.Sort((a, b) => a.pathId.CompareTo(b.pathId));
+
+            const int headerSize = 20;
+            var meta = new MemoryStream();
+            var w = new BinaryWriter(meta);
+            WriteCString(meta, UnityVersion);
+            w.Write(5); // StandaloneWindows
+            w.Write(true); // type trees
+            w.Write(types.Length);
+            foreach (var type in types)
+            {
+                w.Write(type.classId);
+                w.Write((byte)0);
+                w.Write((short)-1);
+                var hash = new byte[16];
+                rnd.NextBytes(hash);
+                w.Write(hash);
+                WriteTree(w, type.tree);
+            }
+            w.Write(objs.Count);
+            uint dataOfs = 0;
+            foreach (var obj in objs)
+            {
+                Align(w, 4, headerSize);
+                w.Write(obj.pathId);
+                w.Write(dataOfs);
+                w.Write(obj.data.Length);
+                w.Write(obj.type);
+                dataOfs = (uint)(dataOfs + obj.data.Length + 7) & ~7u;
+            }
+            w.Write(0); // script types
+            w.Write(0); // externals
+            w.Write((byte)0); // user information
+
+            long metaSize = meta.Length;
+            long dataOffset = (headerSize + metaSize + 15) & ~15;
+            var file = new MemoryStream();
+            WriteBE(file, metaSize, 4);
+            WriteBE(file, dataOffset + dataOfs, 4);
+            WriteBE(file, Format, 4);
+            WriteBE(file, dataOffset, 4);
+            WriteBE(file, 0, 4); // little endian
+            meta.WriteTo(file);
+            file.SetLength(dataOffset);
+            file.Position = dataOffset;
+            foreach (var obj in objs)
+            {
+                file.Write(obj.data, 0, obj.data.Length);
+                file.SetLength((file.Length + 7) & ~7);
+                file.Position = file.Length;
+            }
+            file.SetLength(dataOffset + dataOfs);
+            return file.ToArray();
+        }
+
+        // pixel like data, gradients with noise
+        private static byte[] Resources(BundleOptions o, Random rnd)
+        {
+            var data = new byte[o.textureBytes];
+            var noise = new byte[4096];
+            for (int i = 0; i < data.Length; i++)
+            {
+                if ((i & 4095) == 0)
+                    rnd.NextBytes(noise);
+                data[i] = (byte)((i >> 2) % 1024 / 4 + (noise[i & 4095] & 15));
+            }
+            return data;
+        }
+
+        public static byte[] Compress(byte[] data, int ofs, int count, int compression)
+        {
+            if (compression == 1)
+                return LzmaEnc.Encode(data, ofs, count);
+            if (compression == 2 || compression == 3)
+                return Lz4Enc.Encode(data, ofs, count);
+            if (compression != 0)
+                throw new ArgumentException("Unknown compression " + compression);
+            var b = new byte[count];
+            Buffer.BlockCopy(data, ofs, b, 0, count);
+            return b;
+        }
+
+        // the uncompressed contents of all parts, as written by Write with the same options
+        public static byte[] Contents(BundleOptions o, out int[] partSizes)
+        {
+            var rnd = new Random(o.seed);
+            var parts = new List<byte[]>();
+            for (int i = 0; i < o.assetFiles; i++)
+                parts.Add(SerializedFile(o, rnd, i));
+            parts.Add(Resources(o, rnd));
+            var data = new byte[parts.Sum(x => x.Length)];
+            for (int i = 0, ofs = 0; i < parts.Count; ofs += parts[i++].Length)
+                Buffer.BlockCopy(parts[i], 0, data, ofs, parts[i].Length);
+            partSizes = parts.Select(x => x.Length).ToArray();
+            return data;
+        }
+
+        // Writes the bundle to each of filenames, each with its own header guid
+        public static void Write(IList<string> filenames, BundleOptions o)
+        {
+            var data = Contents(o, out int[] partSizes);
+            var rnd = new Random(o.seed + 1);
+            var cabs = Enumerable.Range(0, o.assetFiles).Select(_ =>
+                "CAB-" + string.Concat(Enumerable.Range(0, 16).Select(__ => rnd.Next(256).ToString("x2")))).ToList();
+
+            var blocks = new List<byte[]>();
+            var blocksInfo = new MemoryStream();
+            int numBlocks = (data.Length + o.blockSize - 1) / o.blockSize;
+            WriteBE(blocksInfo, numBlocks, 4);
+            for (int i = 0; i < numBlocks; i++)
+            {
+                int ofs = i * o.blockSize, count = Math.Min(o.blockSize, data.Length - ofs);
+                int compression = o.compressions[i % o.compressions.Length];
+                var block = Compress(data, ofs, count, compression);
+                blocks.Add(block);
+                WriteBE(blocksInfo, count, 4);
+                WriteBE(blocksInfo, block.Length, 4);
+                WriteBE(blocksInfo, compression, 2);
+            }
+            // the resources of all serialized files go in the .resS of the first
+            WriteBE(blocksInfo, partSizes.Length, 4);
+            for (int i = 0, ofs = 0; i < partSizes.Length; ofs += partSizes[i++])
+            {
+                bool res = i == partSizes.Length - 1;
+                WriteBE(blocksInfo, ofs, 8);
+                WriteBE(blocksInfo, partSizes[i], 8);
+                WriteBE(blocksInfo, res ? 0 : 4, 4); // 4: serialized file
+                WriteCString(blocksInfo, res ? cabs[0] + ".resS" : cabs[i]);
+            }
+
+            foreach (var filename in filenames)
+            {
+                var info = new MemoryStream();
+                var guid = new byte[16];
+                rnd.NextBytes(guid);
+                info.Write(guid, 0, 16);
+                blocksInfo.WriteTo(info);
+                var uInfo = info.ToArray();
+                var cInfo = Compress(uInfo, 0, uInfo.Length, o.infoCompression);
+
+                var hdr = new MemoryStream();
+                WriteCString(hdr, "UnityFS");
+                WriteBE(hdr, 6, 4);
+                WriteCString(hdr, "5.x.x");
+                WriteCString(hdr, UnityVersion);
+                long size = hdr.Length + 8 + 12 + cInfo.Length + blocks.Sum(x => (long)x.Length);
+                WriteBE(hdr, size, 8);
+                WriteBE(hdr, cInfo.Length, 4);
+                WriteBE(hdr, uInfo.Length, 4);
+                WriteBE(hdr, o.infoCompression | 0x40 | (o.eofMetadata ? 0x80 : 0), 4);
+
+                using (var f = File.Create(filename))
+                {
+                    hdr.WriteTo(f);
+                    if (!o.eofMetadata)
+                        f.Write(cInfo, 0, cInfo.Length);
+                    foreach (var block in blocks)
+                        f.Write(block, 0, block.Length);
+                    if (o.eofMetadata)
+                        f.Write(cInfo, 0, cInfo.Length);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,237 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.IO.Compression;
+using System.Text;
+using LevelPost;
+
+namespace LevelPostBench
+{
+    class LevelOptions
+    {
+        public int meshes = 100;
+        public int verts = 2000; // per mesh
+        public int materials = 100; // even ones have a PNG texture, odd ones are bundle materials
+        public int entities = 1000; // instances of the entity_bench_N prefabs
+        public int texSize = 256;
+        public int seed = 1;
+    }
+
+    // Synthetic version 4 level with the commands the converter looks at: meshes with
+    // their game objects, registered materials and instantiated entity prefabs. All
+    // content, including the guids, comes from the seed, so the same options always
+    // give the same file.
+    static class LevelGen
+    {
+        public const int Prefabs = 32;
+
+        public static string MaterialName(int i)
+        {
+            return (i % 2 == 0 ? "bench_tex_" : "bench_mat_") + i;
+        }
+
+        public static string EntityName(int i)
+        {
+            return "entity_bench_" + i;
+        }
+
+        private static Guid NewGuid(Random rnd)
+        {
+            var b = new byte[16];
+            rnd.NextBytes(b);
+            return new Guid(b);
+        }
+
+        private static float F(Random rnd, float scale)
+        {
+            return (float)(rnd.NextDouble() * 2 - 1) * scale;
+        }
+
+        private static float[] Floats(int verts, int n, Func<int, int, float> f)
+        {
+            var a = new float[verts * n];
+            for (int i = 0; i < verts; i++)
+                for (int j = 0; j < n; j++)
+                    a[i * n + j] = f(i, j);
+            return a;
+        }
+
+        // a bumpy grid
+        private static MeshData Mesh(Random rnd, string name, int verts, bool colors)
+        {
+            int cols = (int)Math.Sqrt(verts) + 1;
+            var tris = new int[verts / 2 * 3];
+            for (int i = 0; i < tris.Length; i++)
+                tris[i] = rnd.Next(verts);
+            return new MeshData {
+                name = name,
+                verts = Floats(verts, 3, (i, j) => j == 0 ? i % cols + F(rnd, 0.1f) : j == 1 ? F(rnd, 4) : i / cols + F(rnd, 0.1f)),
+                uv = Floats(verts, 2, (i, j) => (j == 0 ? i % cols : i / cols) / 4f),
+                uv2 = new float[0],
+                norms = Floats(verts, 3, (i, j) => j == 1 ? 1 : F(rnd, 0.2f)),
+                tangs = Floats(verts, 4, (i, j) => j == 0 ? 1 : j == 3 ? -1 : 0),
+                colors = colors ? Floats(verts, 4, (i, j) => j == 3 ? (float)rnd.NextDouble() : 1) : null,
+                bindposes = new float[0],
+                tris = new[] { tris, new int[0] }
+            };
+        }
+
+        public static Level Generate(LevelOptions o)
+        {
+            var rnd = new Random(o.seed);
+            var cmds = new List<object[]>();
+            var file = NewGuid(rnd);
+            cmds.Add(new object[] { VT.CmdCreateAssetFile, "level", file });
+
+            var matIds = new Guid[o.materials];
+            for (int i = 0; i < o.materials; i++)
+            {
+                matIds[i] = NewGuid(rnd);
+                cmds.Add(new object[] { VT.CmdAssetRegisterMaterial, matIds[i], 0, MaterialName(i) });
+            }
+
+            // render mesh chunks like the editor exports them, the mesh is saved after it is assigned
+            for (int m = 0; m < o.meshes; m++)
+            {
+                Guid mesh = NewGuid(rnd), obj = NewGuid(rnd), filter = NewGuid(rnd), renderer = NewGuid(rnd);
+                cmds.Add(new object[] { VT.CmdAddAssetToAssetFile, file, mesh, "UnityEngine.Mesh" });
+                cmds.Add(new object[] { VT.CmdCreateGameObject, obj, NewGuid(rnd) });
+                cmds.Add(new object[] { VT.CmdGameObjectSetName, obj, "chunk_" + m });
+                cmds.Add(new object[] { VT.CmdGameObjectAddComponent, obj, filter, "MeshFilter" });
+                cmds.Add(new object[] { VT.CmdGameObjectAddComponent, obj, renderer, "MeshRenderer" });
+                cmds.Add(new object[] { VT.CmdGameObjectSetComponentProperty, renderer, "m_Enabled", (byte)0, (byte)0, true });
+                cmds.Add(new object[] { VT.CmdGameObjectSetComponentProperty, renderer, "m_Layer", (byte)0, (byte)0, m % 32 });
+                if (o.materials != 0)
+                    cmds.Add(new object[] { VT.CmdGameObjectSetComponentProperty, renderer, "sharedMaterial", (byte)0, (byte)0,
+                        matIds[m % o.materials] });
+                cmds.Add(new object[] { VT.CmdGameObjectSetComponentProperty, filter, "sharedMesh", (byte)0, (byte)0, mesh });
+                cmds.Add(new object[] { VT.CmdSaveAsset, mesh, Mesh(rnd, "chunk_" + m + "__RenderMesh", o.verts, m % 2 == 0) });
+            }
+
+            var prefabIds = new Guid[Prefabs];
+            for (int i = 0; i < o.entities; i++)
+            {
+                int kind = i % Prefabs;
+                if (prefabIds[kind] == Guid.Empty)
+                {
+                    prefabIds[kind] = NewGuid(rnd);
+                    cmds.Add(new object[] { VT.CmdFindPrefabReference, EntityName(kind), prefabIds[kind] });
+                }
+                Guid obj = NewGuid(rnd), comp = NewGuid(rnd);
+                cmds.Add(new object[] { VT.CmdInstantiatePrefab, prefabIds[kind], obj, NewGuid(rnd) });
+                cmds.Add(new object[] { VT.CmdGetComponentAtRuntime, false, "PropBase", obj, comp });
+                cmds.Add(new object[] { VT.CmdGameObjectSetComponentProperty, comp, "m_index", (byte)0, (byte)0, i });
+                cmds.Add(new object[] { VT.CmdGameObjectSetComponentProperty, comp, "m_position", (byte)0, (byte)0,
+                    new Vector3 { x = F(rnd, 100), y = F(rnd, 100), z = F(rnd, 100) } });
+                cmds.Add(new object[] { VT.CmdGameObjectSetComponentProperty, comp, "m_team", (byte)0, (byte)0,
+                    new object[] { VT.Enum, i % 3, "Team" } });
+            }
+
+            cmds.Add(new object[] { VT.CmdDone });
+            return new Level { version = 4, cmds = cmds };
+        }
+
+        // <dir>/<name>.png for every material with a texture, a quarter of them with alpha
+        public static long WriteTextures(string dir, LevelOptions o)
+        {
+            var rnd = new Random(o.seed);
+            int size = o.texSize;
+            var rgba = new byte[size * size * 4];
+            long total = 0;
+            for (int i = 0; i < o.materials; i += 2)
+            {
+                bool alpha = i % 8 == 0;
+                for (int y = 0, p = 0; y < size; y++)
+                    for (int x = 0; x < size; x++, p += 4)
+                    {
+                        int n = rnd.Next(24);
+                        rgba[p] = (byte)(x * 256 / size + n);
+                        rgba[p + 1] = (byte)(y * 256 / size + n);
+                        rgba[p + 2] = (byte)(((x / 16 + y / 16) & 1) * 160 + n);
+                        rgba[p + 3] = alpha ? (byte)(x * 255 / size) : (byte)255;
+                    }
+                var filename = Path.Combine(dir, MaterialName(i) + ".png");
+                WritePng(filename, rgba, size, size);
+                total += new FileInfo(filename).Length;
+            }
+            return total;
+        }
+
+        private static uint[] crcTable;
+
+        private static uint Crc(byte[] data, int ofs, int len)
+        {
+            if (crcTable == null)
+            {
+                var t = new uint[256];
+                for (uint n = 0; n < 256; n++)
+                {
+                    uint c = n;
+                    for (int k = 0; k < 8; k++)
+                        c = (c & 1) != 0 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+                    t[n] = c;
+                }
+                crcTable = t;
+            }
+            uint crc = 0xffffffff;
+            for (int i = ofs; i < ofs + len; i++)
+                crc = crcTable[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+            return crc ^ 0xffffffff;
+        }
+
+        private static void WriteBE(Stream s, uint v)
+        {
+            s.WriteByte((byte)(v >> 24));
+            s.WriteByte((byte)(v >> 16));
+            s.WriteByte((byte)(v >> 8));
+            s.WriteByte((byte)v);
+        }
+
+        private static void WriteChunk(Stream s, string type, byte[] data)
+        {
+            var chunk = new byte[4 + data.Length];
+            Encoding.ASCII.GetBytes(type, 0, 4, chunk, 0);
+            Buffer.BlockCopy(data, 0, chunk, 4, data.Length);
+            WriteBE(s, (uint)data.Length);
+            s.Write(chunk, 0, chunk.Length);
+            WriteBE(s, Crc(chunk, 0, chunk.Length));
+        }
+
+        // 8 bit RGBA PNG, rows top to bottom without filtering
+        public static void WritePng(string filename, byte[] rgba, int width, int height)
+        {
+            var z = new MemoryStream();
+            z.WriteByte(0x78);
+            z.WriteByte(0x9c);
+            uint a = 1, b = 0;
+            using (var deflate = new DeflateStream(z, CompressionLevel.Fastest, true))
+            {
+                var row = new byte[width * 4 + 1];
+                for (int y = 0; y < height; y++)
+                {
+                    Buffer.BlockCopy(rgba, y * width * 4, row, 1, width * 4);
+                    foreach (var c in row)
+                    {
+                        a = (a + c) % 65521;
+                        b = (b + a) % 65521;
+                    }
+                    deflate.Write(row, 0, row.Length);
+                }
+            }
+            WriteBE(z, (b << 16) | a);
+
+            var hdr = new MemoryStream();
+            WriteBE(hdr, (uint)width);
+            WriteBE(hdr, (uint)height);
+            hdr.Write(new byte[] { 8, 6, 0, 0, 0 }, 0, 5); // 8 bit RGBA
+
+            using (var f = File.Create(filename))
+            {
+                f.Write(new byte[] { 0x89, (byte)'P', (byte)'N', (byte)'G', 13, 10, 26, 10 }, 0, 8);
+                WriteChunk(f, "IHDR", hdr.ToArray());
+                WriteChunk(f, "IDAT", z.ToArray());
+                WriteChunk(f, "IEND", new byte[0]);
+            }
+        }
+    }
+}
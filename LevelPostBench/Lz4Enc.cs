@@ -0,0 +1,70 @@
+﻿using System;
+using System.IO;
+
+namespace LevelPostBench
+{
+    // Greedy LZ4 block encoder for the generated bundles. One hash table entry per
+    // position and no lazy matching, so it compresses less than lz4 itself, but the
+    // output is a valid raw LZ4 block.
+    static class Lz4Enc
+    {
+        private const int MinMatch = 4;
+        private const int LastLiterals = 5; // the block ends with at least this many literals
+        private const int MatchLimit = 12; // no match may start in the last 12 bytes
+        private const int HashBits = 16;
+
+        private static int Read32(byte[] src, int i)
+        {
+            return src[i] | (src[i + 1] << 8) | (src[i + 2] << 16) | (src[i + 3] << 24);
+        }
+
+        private static void WriteLength(MemoryStream dst, int len)
+        {
+            for (; len >= 255; len -= 255)
+                dst.WriteByte(255);
+            dst.WriteByte((byte)len);
+        }
+
+        private static void WriteSequence(MemoryStream dst, byte[] src, int litOfs, int litLen, int offset, int matchLen)
+        {
+            int ml = matchLen - MinMatch;
+            dst.WriteByte((byte)((Math.Min(litLen, 15) << 4) | (matchLen == 0 ? 0 : Math.Min(ml, 15))));
+            if (litLen >= 15)
+                WriteLength(dst, litLen - 15);
+            dst.Write(src, litOfs, litLen);
+            if (matchLen == 0)
+                return;
+            dst.WriteByte((byte)offset);
+            dst.WriteByte((byte)(offset >> 8));
+            if (ml >= 15)
+                WriteLength(dst, ml - 15);
+        }
+
+        public static byte[] Encode(byte[] src, int ofs, int len)
+        {
+            var dst = new MemoryStream(len + len / 255 + 16);
+            var table = new int[1 << HashBits]; // position + 1 of the last occurrence
+            int end = ofs + len, anchor = ofs, ip = ofs;
+            while (ip < end - MatchLimit)
+            {
+                int seq = Read32(src, ip);
+                int h = (int)((uint)(seq * -1640531535) >> (32 - HashBits));
+                int r = table[h] - 1;
+                table[h] = ip + 1;
+                if (r < ofs || ip - r > 65535 || Read32(src, r) != seq)
+                {
+                    ip++;
+                    continue;
+                }
+                int matchLen = MinMatch;
+                while (ip + matchLen < end - LastLiterals && src[r + matchLen] == src[ip + matchLen])
+                    matchLen++;
+                WriteSequence(dst, src, anchor, ip - anchor, ip - r, matchLen);
+                ip += matchLen;
+                anchor = ip;
+            }
+            WriteSequence(dst, src, anchor, end - anchor, 0, 0);
+            return dst.ToArray();
+        }
+    }
+}
@@ -0,0 +1,268 @@
+﻿using System;
+using System.IO;
+
+namespace LevelPostBench
+{
+    // Greedy LZMA encoder (lc=3, lp=0, pb=2) for the generated bundles. Matches come
+    // from a short hash chain and are taken as soon as they are found, without repeat
+    // matches or optimal parsing, so the output is larger than from the LZMA SDK but
+    // decodes the same. Returns the 5 byte props followed by the stream without end
+    // marker, like the LZMA blocks in UnityFS bundles.
+    class LzmaEnc
+    {
+        private const int LC = 3, PB = 2;
+        private const int NumStates = 12;
+        private const int MinMatch = 3, MaxMatch = 273;
+        private const int HashBits = 16, ChainDepth = 4;
+        private const int EndPosModelIndex = 14, NumFullDistances = 128, NumAlignBits = 4;
+
+        private class LenProbs
+        {
+            public ushort[] choice = Probs(2);
+            public ushort[] low = Probs(8 << PB);
+            public ushort[] mid = Probs(8 << PB);
+            public ushort[] high = Probs(256);
+        }
+
+        private readonly MemoryStream dst;
+        private ulong low;
+        private uint range = 0xffffffff;
+        private byte cache;
+        private long cacheSize = 1;
+
+        private readonly ushort[] isMatch = Probs(NumStates << PB);
+        private readonly ushort[] isRep = Probs(NumStates);
+        private readonly ushort[] literal = Probs(0x300 << LC);
+        private readonly ushort[] posSlot = Probs(4 << 6);
+        private readonly ushort[] specPos = Probs(NumFullDistances - EndPosModelIndex);
+        private readonly ushort[] align = Probs(1 << NumAlignBits);
+        private readonly LenProbs len = new LenProbs();
+
+        private static ushort[] Probs(int n)
+        {
+            var p = new ushort[n];
+            for (int i = 0; i < n; i++)
+                p[i] = 1024;
+            return p;
+        }
+
+        private LzmaEnc(int capacity)
+        {
+            dst = new MemoryStream(capacity);
+        }
+
+        private void ShiftLow()
+        {
+            if ((uint)low < 0xff000000 || (low >> 32) != 0)
+            {
+                byte carry = (byte)(low >> 32), b = cache;
+                do
+                {
+                    dst.WriteByte((byte)(b + carry));
+                    b = 0xff;
+                } while (--cacheSize != 0);
+                cache = (byte)((uint)low >> 24);
+            }
+            cacheSize++;
+            low = (low & 0xffffff) << 8;
+        }
+
+        private void EncodeBit(ushort[] probs, int i, int bit)
+        {
+            uint p = probs[i], bound = (range >> 11) * p;
+            if (bit == 0)
+            {
+                range = bound;
+                probs[i] = (ushort)(p + ((2048 - p) >> 5));
+            }
+            else
+            {
+                low += bound;
+                range -= bound;
+                probs[i] = (ushort)(p - (p >> 5));
+            }
+            if (range < 1u << 24)
+            {
+                range <<= 8;
+                ShiftLow();
+            }
+        }
+
+        private void EncodeDirect(int value, int numBits)
+        {
+            for (int i = numBits - 1; i >= 0; i--)
+            {
+                range >>= 1;
+                if (((value >> i) & 1) != 0)
+                    low += range;
+                if (range < 1u << 24)
+                {
+                    range <<= 8;
+                    ShiftLow();
+                }
+            }
+        }
+
+        private void EncodeTree(ushort[] probs, int ofs, int numBits, int symbol)
+        {
+            for (int m = 1, i = numBits - 1; i >= 0; i--)
+            {
+                int bit = (symbol >> i) & 1;
+                EncodeBit(probs, ofs + m, bit);
+                m = (m << 1) | bit;
+            }
+        }
+
+        private void EncodeReverse(ushort[] probs, int ofs, int numBits, int symbol)
+        {
+            for (int m = 1, i = 0; i < numBits; i++, symbol >>= 1)
+            {
+                int bit = symbol & 1;
+                EncodeBit(probs, ofs + m, bit);
+                m = (m << 1) | bit;
+            }
+        }
+
+        private void EncodeLiteral(int ctx, int b, int matchByte, bool matched)
+        {
+            int ofs = 0x300 * ctx;
+            bool same = matched;
+            for (int m = 1, i = 7; i >= 0; i--)
+            {
+                int bit = (b >> i) & 1, p = m;
+                if (same)
+                {
+                    int matchBit = (matchByte >> i) & 1;
+                    p += (1 + matchBit) << 8;
+                    same = matchBit == bit;
+                }
+                EncodeBit(literal, ofs + p, bit);
+                m = (m << 1) | bit;
+            }
+        }
+
+        private void EncodeLength(int l, int posState)
+        {
+            l -= 2;
+            if (l < 8)
+            {
+                EncodeBit(len.choice, 0, 0);
+                EncodeTree(len.low, posState << 3, 3, l);
+            }
+            else if (l < 16)
+            {
+                EncodeBit(len.choice, 0, 1);
+                EncodeBit(len.choice, 1, 0);
+                EncodeTree(len.mid, posState << 3, 3, l - 8);
+            }
+            else
+            {
+                EncodeBit(len.choice, 0, 1);
+                EncodeBit(len.choice, 1, 1);
+                EncodeTree(len.high, 0, 8, l - 16);
+            }
+        }
+
+        private static int GetPosSlot(int dist)
+        {
+            if (dist < 4)
+                return dist;
+            int n = 31;
+            while ((dist >> n) == 0)
+                n--;
+            return (n << 1) | ((dist >> (n - 1)) & 1);
+        }
+
+        private void EncodeDistance(int dist, int matchLen)
+        {
+            int slot = GetPosSlot(dist);
+            EncodeTree(posSlot, Math.Min(matchLen - 2, 3) << 6, 6, slot);
+            if (slot < 4)
+                return;
+            int footerBits = (slot >> 1) - 1;
+            int baseDist = (2 | (slot & 1)) << footerBits;
+            int reduced = dist - baseDist;
+            if (slot < EndPosModelIndex)
+                EncodeReverse(specPos, baseDist - slot - 1, footerBits, reduced);
+            else
+            {
+                EncodeDirect(reduced >> NumAlignBits, footerBits - NumAlignBits);
+                EncodeReverse(align, 0, NumAlignBits, reduced & ((1 << NumAlignBits) - 1));
+            }
+        }
+
+        public static byte[] Encode(byte[] src, int ofs, int count, int dictSize = 1 << 22)
+        {
+            var enc = new LzmaEnc(count / 2 + 64);
+            enc.dst.WriteByte((PB * 5 + 0) * 9 + LC);
+            enc.dst.Write(BitConverter.GetBytes(dictSize), 0, 4);
+            enc.EncodeData(src, ofs, count, dictSize);
+            return enc.dst.ToArray();
+        }
+
+        private void EncodeData(byte[] src, int ofs, int count, int dictSize)
+        {
+            var head = new int[1 << HashBits]; // position + 1 of the last occurrence
+            var prev = new int[count];
+            int state = 0, rep0 = 0, end = ofs + count;
+            for (int pos = 0; pos < count; )
+            {
+                int ip = ofs + pos, posState = pos & ((1 << PB) - 1);
+                int bestLen = 0, bestDist = 0;
+                if (end - ip >= MinMatch)
+                {
+                    int maxLen = Math.Min(MaxMatch, end - ip);
+                    for (int c = head[Hash(src, ip)] - 1, depth = 0; c >= 0 && depth < ChainDepth && pos - c <= dictSize; c = prev[c] - 1, depth++)
+                    {
+                        int r = ofs + c, l = 0;
+                        while (l < maxLen && src[r + l] == src[ip + l])
+                            l++;
+                        if (l > bestLen)
+                        {
+                            bestLen = l;
+                            bestDist = pos - c;
+                            if (l == maxLen)
+                                break;
+                        }
+                    }
+                }
+                // a short match far away costs more than its literals
+                if (bestLen < MinMatch || (bestLen == MinMatch && bestDist > 1 << 12))
+                {
+                    EncodeBit(isMatch, (state << PB) + posState, 0);
+                    int prevByte = pos > 0 ? src[ip - 1] : 0;
+                    EncodeLiteral(prevByte >> (8 - LC), src[ip], pos > rep0 ? src[ip - rep0 - 1] : 0, state >= 7);
+                    state = state < 4 ? 0 : state < 10 ? state - 3 : state - 6;
+                    Insert(src, ofs, pos, end, head, prev);
+                    pos++;
+                    continue;
+                }
+                EncodeBit(isMatch, (state << PB) + posState, 1);
+                EncodeBit(isRep, state, 0);
+                EncodeLength(bestLen, posState);
+                rep0 = bestDist - 1;
+                EncodeDistance(rep0, bestLen);
+                state = state < 7 ? 7 : 10;
+                for (int i = 0; i < bestLen; i++)
+                    Insert(src, ofs, pos + i, end, head, prev);
+                pos += bestLen;
+            }
+            for (int i = 0; i < 5; i++)
+                ShiftLow();
+        }
+
+        private static int Hash(byte[] src, int i)
+        {
+            return (int)((uint)((src[i] | (src[i + 1] << 8) | (src[i + 2] << 16)) * -1640531535) >> (32 - HashBits));
+        }
+
+        private static void Insert(byte[] src, int ofs, int pos, int end, int[] head, int[] prev)
+        {
+            if (end - (ofs + pos) < MinMatch)
+                return;
+            int h = Hash(src, ofs + pos);
+            prev[pos] = head[h];
+            head[h] = pos + 1;
+        }
+    }
+}
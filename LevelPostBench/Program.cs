@@ -0,0 +1,268 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Globalization;
+using System.IO;
+using System.Linq;
+using System.Runtime.InteropServices;
+using System.Text;
+using System.Text.RegularExpressions;
+using rdbundle;
+
+namespace LevelPostBench
+{
+    class Program
+    {
+        const string Usage =
+            "Usage: LevelPostBench [-n runs] [-f name[,name..]] [-w workdir] [-k] [-o result.json]\n" +
+            "                      [-c baseline.json] [-t percent] [option=value..]\n" +
+            "Level options: meshes, verts, materials, entities, texsize, seed\n" +
+            "Bundle options: bundlematerials, bundleentities, assetfiles, meshmb, texturemb, blockkb,\n" +
+            "                blocks (list of lzma, lz4, none), info (lzma, lz4, none), eof (0 or 1),\n" +
+            "                scan (bundle copies to scan), decodemb (LZMA/LZ4 decoder data)";
+
+        static int Compression(string name)
+        {
+            switch (name.ToLowerInvariant())
+            {
+                case "none": return 0;
+                case "lzma": return 1;
+                case "lz4": return 2;
+            }
+            throw new ArgumentException("unknown compression " + name);
+        }
+
+        static Dictionary<string, Action<string>> Options(Suite suite)
+        {
+            var l = suite.level;
+            var b = suite.bundle;
+            Func<string, int> i = s => int.Parse(s, CultureInfo.InvariantCulture);
+            return new Dictionary<string, Action<string>>(StringComparer.OrdinalIgnoreCase)
+            {
+                { "meshes", v => l.meshes = i(v) },
+                { "verts", v => l.verts = i(v) },
+                { "materials", v => l.materials = i(v) },
+                { "entities", v => l.entities = i(v) },
+                { "texsize", v => l.texSize = i(v) },
+                { "seed", v => b.seed = l.seed = i(v) },
+                { "bundlematerials", v => b.materials = i(v) },
+                { "bundleentities", v => b.entities = i(v) },
+                { "assetfiles", v => b.assetFiles = i(v) },
+                { "meshmb", v => b.meshBytes = i(v) << 20 },
+                { "texturemb", v => b.textureBytes = i(v) << 20 },
+                { "blockkb", v => b.blockSize = i(v) << 10 },
+                { "blocks", v => b.compressions = v.Split(',').Select(Compression).ToArray() },
+                { "info", v => b.infoCompression = Compression(v) },
+                { "eof", v => b.eofMetadata = i(v) != 0 },
+                { "scan", v => suite.scanBundles = i(v) },
+                { "decodemb", v => suite.decodeBytes = i(v) << 20 },
+            };
+        }
+
+        static int Main(string[] args)
+        {
+            int runs = 5;
+            double threshold = 15;
+            bool keep = false;
+            string workDir = null, outFile = null, baseFile = null;
+            string[] filter = null;
+            var suite = new Suite();
+            var options = Options(suite);
+            try
+            {
+                for (int i = 0; i < args.Length; i++)
+                {
+                    var arg = args[i];
+                    int eq = arg.IndexOf('=');
+                    if (arg == "-k")
+                        keep = true;
+                    else if (arg.StartsWith("-") && i + 1 == args.Length)
+                        throw new ArgumentException("missing value for " + arg);
+                    else if (arg == "-n")
+                        runs = int.Parse(args[++i]);
+                    else if (arg == "-f")
+                        filter = args[++i].Split(',');
+                    else if (arg == "-w")
+                        workDir = args[++i];
+                    else if (arg == "-o")
+                        outFile = args[++i];
+                    else if (arg == "-c")
+                        baseFile = args[++i];
+                    else if (arg == "-t")
+                        threshold = double.Parse(args[++i], CultureInfo.InvariantCulture);
+                    else if (eq > 0 && options.TryGetValue(arg.Substring(0, eq), out Action<string> set))
+                        set(arg.Substring(eq + 1));
+                    else
+                        throw new ArgumentException("unknown argument " + arg);
+                }
+                if (runs < 1)
+                    throw new ArgumentException("at least one run is needed");
+            }
+            catch (Exception ex) when (ex is ArgumentException || ex is FormatException || ex is OverflowException)
+            {
+                Console.Error.WriteLine("Error: " + ex.Message);
+                Console.Error.WriteLine(Usage);
+                return 2;
+            }
+
+            Dictionary<string, double> baseline = null;
+            try
+            {
+                if (baseFile != null)
+                    baseline = ReadBaseline(baseFile);
+            }
+            catch (IOException ex)
+            {
+                Console.Error.WriteLine("Error: cannot read " + baseFile + ": " + ex.Message);
+                return 2;
+            }
+
+            // the Windows fallback decoder is not available elsewhere
+            suite.lzma = LzmaDec.HasNativeLib || Environment.OSVersion.Platform == PlatformID.Win32NT;
+            if (!suite.lzma)
+            {
+                Console.Error.WriteLine("Warning: no native lzmadec library, skipping LZMA");
+                suite.bundle.compressions = suite.bundle.compressions.Where(x => x != 1).DefaultIfEmpty(0).ToArray();
+                if (suite.bundle.infoCompression == 1)
+                    suite.bundle.infoCompression = 2;
+            }
+
+            bool tempDir = workDir == null;
+            if (tempDir)
+                workDir = Path.Combine(Path.GetTempPath(), "LevelPostBench-" + Process.GetCurrentProcess().Id);
+            Directory.CreateDirectory(workDir);
+
+            Console.WriteLine(RuntimeInformation.FrameworkDescription + ", " + RuntimeInformation.OSDescription.Trim() +
+                ", " + Environment.ProcessorCount + " cores, native lib " + (LzmaDec.HasNativeLib ? "yes" : "no") +
+                ", allocations from " + Allocs.Source);
+            var results = new List<BenchResult>();
+            try
+            {
+                var sw = Stopwatch.StartNew();
+                suite.Generate(workDir, msg => Console.WriteLine(msg));
+                Console.WriteLine("generated in " + workDir + " in " + (sw.ElapsedMilliseconds / 1000.0).ToString("0.0") + " s");
+                Console.WriteLine();
+                Console.WriteLine(string.Format("{0,-28} {1,10} {2,10} {3,9} {4,10} {5,6}{6}",
+                    "benchmark", "median ms", "min ms", "MB/s", "alloc MB", "gen0", baseline != null ? "  change" : ""));
+
+                foreach (var bench in suite.Benchmarks())
+                {
+                    if (filter != null && !filter.Any(x => bench.name.IndexOf(x, StringComparison.OrdinalIgnoreCase) >= 0))
+                        continue;
+                    var r = BenchRunner.Run(bench, runs);
+                    results.Add(r);
+                    if (r.error != null)
+                    {
+                        Console.WriteLine(string.Format("{0,-28} failed: {1}", r.name, r.error));
+                        continue;
+                    }
+                    string change = "";
+                    if (baseline != null && baseline.TryGetValue(r.name, out double baseMs) && baseMs > 0)
+                    {
+                        double pct = (r.medianMs / baseMs - 1) * 100;
+                        change = string.Format(CultureInfo.InvariantCulture, "  {0,6:+0;-0;0}%{1}", pct, pct > threshold ? " slower" : "");
+                    }
+                    Console.WriteLine(string.Format(CultureInfo.InvariantCulture, "{0,-28} {1,10:0.00} {2,10:0.00} {3,9:0.0} {4,10} {5,6:0.#}{6}",
+                        r.name, r.medianMs, r.minMs, r.MBPerSec, r.allocBytes < 0 ? "-" : (r.allocBytes / 1e6).ToString("0.0", CultureInfo.InvariantCulture),
+                        r.gen0, change));
+                }
+            }
+            finally
+            {
+                if (tempDir && !keep)
+                    try
+                    {
+                        Directory.Delete(workDir, true);
+                    }
+                    catch (IOException)
+                    {
+                    }
+            }
+
+            if (outFile != null)
+                File.WriteAllText(outFile, ToJson(suite, results, runs));
+
+            bool regressed = baseline != null && results.Any(r => r.error == null &&
+                baseline.TryGetValue(r.name, out double ms) && ms > 0 && (r.medianMs / ms - 1) * 100 > threshold);
+            return results.Any(x => x.error != null) || regressed ? 1 : 0;
+        }
+
+        // medianMs per benchmark name from an earlier -o result
+        static Dictionary<string, double> ReadBaseline(string filename)
+        {
+            var times = new Dictionary<string, double>();
+            foreach (Match m in Regex.Matches(File.ReadAllText(filename), "\"name\": \"((?:[^\"\\\\]|\\\\.)*)\".*?\"medianMs\": ([0-9.]+)"))
+                times[Regex.Unescape(m.Groups[1].Value)] = double.Parse(m.Groups[2].Value, CultureInfo.InvariantCulture);
+            return times;
+        }
+
+        static string ToJson(Suite suite, List<BenchResult> results, int runs)
+        {
+            var sb = new StringBuilder();
+            sb.Append("{\n  \"runtime\": ").Append(Str(RuntimeInformation.FrameworkDescription));
+            sb.Append(",\n  \"os\": ").Append(Str(RuntimeInformation.OSDescription.Trim()));
+            sb.Append(",\n  \"cores\": ").Append(Environment.ProcessorCount);
+            sb.Append(",\n  \"runs\": ").Append(runs);
+            sb.Append(",\n  \"level\": {").Append(Fields(suite.level)).Append("}");
+            sb.Append(",\n  \"bundle\": {").Append(Fields(suite.bundle)).Append("}");
+            sb.Append(",\n  \"benchmarks\": [");
+            for (int i = 0; i < results.Count; i++)
+            {
+                var r = results[i];
+                sb.Append(i == 0 ? "\n    {" : ",\n    {");
+                sb.Append("\"name\": ").Append(Str(r.name));
+                if (r.error != null)
+                {
+                    sb.Append(", \"error\": ").Append(Str(r.error)).Append("}");
+                    continue;
+                }
+                sb.Append(", \"medianMs\": ").Append(Num(r.medianMs));
+                sb.Append(", \"minMs\": ").Append(Num(r.minMs));
+                sb.Append(", \"maxMs\": ").Append(Num(r.maxMs));
+                sb.Append(", \"bytes\": ").Append(r.bytes);
+                sb.Append(", \"mbPerSec\": ").Append(Num(r.MBPerSec));
+                if (r.allocBytes >= 0)
+                    sb.Append(", \"allocBytes\": ").Append(Math.Round(r.allocBytes).ToString(CultureInfo.InvariantCulture));
+                sb.Append(", \"gen0\": ").Append(Num(r.gen0));
+                sb.Append(", \"gen2\": ").Append(Num(r.gen2)).Append("}");
+            }
+            sb.Append(results.Count == 0 ? "]\n}\n" : "\n  ]\n}\n");
+            return sb.ToString();
+        }
+
+        static string Fields(object o)
+        {
+            return string.Join(", ", o.GetType().GetFields().Select(f => {
+                var v = f.GetValue(o);
+                return Str(f.Name) + ": " + (v is int[] a ? "[" + string.Join(", ", a) + "]" :
+                    v is bool b ? (b ? "true" : "false") : v.ToString());
+            }));
+        }
+
+        static string Num(double x)
+        {
+            return Math.Round(x, 2).ToString(CultureInfo.InvariantCulture);
+        }
+
+        static string Str(string s)
+        {
+            var sb = new StringBuilder("\"");
+            foreach (char c in s)
+                switch (c)
+                {
+                    case '"': sb.Append("\\\""); break;
+                    case '\\': sb.Append("\\\\"); break;
+                    case '\n': sb.Append("\\n"); break;
+                    case '\r': sb.Append("\\r"); break;
+                    case '\t': sb.Append("\\t"); break;
+                    default:
+                        if (c < ' ')
+                            sb.Append("\\u").Append(((int)c).ToString("x4"));
+                        else
+                            sb.Append(c);
+                        break;
+                }
+            return sb.Append('"').ToString();
+        }
+    }
+}
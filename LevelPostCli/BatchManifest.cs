@@ -0,0 +1,187 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using LevelPost;
+using YamlDotNet.RepresentationModel;
+
+namespace LevelPostCli
+{
+    class BatchLevel
+    {
+        public string file;
+        public List<string> bundles = new List<string>();
+    }
+
+    // Levels and conversion options for a batch run, read from a YAML file like:
+    //
+    //   jobs: 4                      # levels converted at the same time, default one per core
+    //   editorDir: C:\Games\Overload\OverloadLevelEditor
+    //   texDirs: [textures, ../shared/textures]
+    //   texPointPx: 64
+    //   defaultProbes: remove        # keep, forceOn or remove
+    //   probeRes: 256
+    //   boxLavaNormalProbe: false
+    //   texCacheDir: cache/textures  # none for memory only
+    //   bundleIndex: cache/bundles.idx
+    //   incrementalDir: cache/levels # reuse earlier conversions, default none
+    //   levels:
+    //     - maps/simple.overload
+    //     - file: maps/custom.overload
+    //       bundles: [maps/custom/windows/custom]
+    //
+    // Relative paths are relative to the manifest file.
+    class BatchManifest
+    {
+        public int jobs = Environment.ProcessorCount;
+        public string editorDir;
+        public List<string> texDirs = new List<string>();
+        public int texPointPx = 64;
+        public bool defaultProbeRemove;
+        public bool defaultProbeHide;
+        public bool boxLavaNormalProbe;
+        public int probeRes = 256;
+        public string texCacheDir = TexCache.DefaultDir;
+        public string bundleIndex = BundleFiles.DefaultIndexPath;
+        public string incrementalDir;
+        public List<BatchLevel> levels = new List<BatchLevel>();
+
+        private string baseDir;
+
+        public static BatchManifest Load(string filename)
+        {
+            var yaml = new YamlStream();
+            using (var stream = File.OpenText(filename))
+                yaml.Load(stream);
+            var m = new BatchManifest() { baseDir = Path.GetDirectoryName(Path.GetFullPath(filename)) };
+            if (yaml.Documents.Count == 0 || !(yaml.Documents[0].RootNode is YamlMappingNode map))
+                throw new Exception(filename + ": expected a mapping of options and levels");
+            foreach (var entry in map.Children)
+            {
+                string key = entry.Key.ToString();
+                var val = entry.Value;
+                switch (key)
+                {
+                    case "jobs": m.jobs = Int(val); break;
+                    case "editorDir": m.editorDir = m.PathOrNone(val); break;
+                    case "texDirs": m.texDirs = List(val).Select(x => m.FullPath(Str(x))).ToList(); break;
+                    case "texPointPx": m.texPointPx = Int(val); break;
+                    case "defaultProbes":
+                        switch (Str(val))
+                        {
+                            case "keep": m.defaultProbeRemove = m.defaultProbeHide = false; break;
+                            case "forceOn": m.defaultProbeRemove = false; m.defaultProbeHide = true; break;
+                            case "remove": m.defaultProbeRemove = true; m.defaultProbeHide = false; break;
+                            default: throw Error(val, "expected keep, forceOn or remove");
+                        }
+                        break;
+                    case "probeRes": m.probeRes = Int(val); break;
+                    case "boxLavaNormalProbe": m.boxLavaNormalProbe = Bool(val); break;
+                    case "texCacheDir": m.texCacheDir = m.PathOrNone(val); break;
+                    case "bundleIndex": m.bundleIndex = m.PathOrNone(val); break;
+                    case "incrementalDir": m.incrementalDir = m.PathOrNone(val); break;
+                    case "levels":
+                        foreach (var item in List(val))
+                            m.levels.Add(m.Level(item));
+                        break;
+                    default: throw Error(entry.Key, "unknown option " + key);
+                }
+            }
+            if (m.jobs < 1)
+                m.jobs = 1;
+            return m;
+        }
+
+        // A fresh ConvertSettings for each level, they get their own bundles added
+        public ConvertSettings CreateSettings()
+        {
+            var ignoreDirs = new List<string>();
+            if (editorDir != null)
+                foreach (var name in new string[]{"LevelTextures", "DecalTextures"})
+                {
+                    string subdir = Path.Combine(editorDir, name);
+                    if (Directory.Exists(subdir))
+                        ignoreDirs.Add(subdir);
+                }
+            return new ConvertSettings() {
+                texDirs = texDirs.Where(Directory.Exists).ToList(),
+                ignoreTexDirs = ignoreDirs,
+                texPointPx = texPointPx,
+                defaultProbeRemove = defaultProbeRemove,
+                defaultProbeHide = defaultProbeHide,
+                boxLavaNormalProbe = boxLavaNormalProbe,
+                probeRes = probeRes,
+                texCacheDir = texCacheDir,
+                incrementalDir = incrementalDir
+            };
+        }
+
+        private BatchLevel Level(YamlNode node)
+        {
+            if (node is YamlScalarNode)
+                return new BatchLevel() { file = FullPath(Str(node)) };
+            if (!(node is YamlMappingNode map))
+                throw Error(node, "expected a level file or a mapping with file and bundles");
+            var level = new BatchLevel();
+            foreach (var entry in map.Children)
+                switch (entry.Key.ToString())
+                {
+                    case "file": level.file = FullPath(Str(entry.Value)); break;
+                    case "bundles": level.bundles = List(entry.Value).Select(x => FullPath(Str(x))).ToList(); break;
+                    default: throw Error(entry.Key, "unknown level option " + entry.Key);
+                }
+            if (level.file == null)
+                throw Error(node, "level without file");
+            return level;
+        }
+
+        private string FullPath(string path)
+        {
+            return Path.GetFullPath(Path.Combine(baseDir, path));
+        }
+
+        private string PathOrNone(YamlNode node)
+        {
+            string s = Str(node);
+            return s == "" || s == "none" ? null : FullPath(s);
+        }
+
+        private static Exception Error(YamlNode node, string msg)
+        {
+            return new Exception("line " + node.Start.Line + ": " + msg);
+        }
+
+        private static string Str(YamlNode node)
+        {
+            if (!(node is YamlScalarNode scalar))
+                throw Error(node, "expected a value");
+            return scalar.Value ?? "";
+        }
+
+        private static int Int(YamlNode node)
+        {
+            if (!int.TryParse(Str(node), out int n))
+                throw Error(node, "expected a number");
+            return n;
+        }
+
+        private static bool Bool(YamlNode node)
+        {
+            switch (Str(node))
+            {
+                case "true": case "yes": case "on": return true;
+                case "false": case "no": case "off": return false;
+                default: throw Error(node, "expected true or false");
+            }
+        }
+
+        private static IEnumerable<YamlNode> List(YamlNode node)
+        {
+            if (node is YamlSequenceNode seq)
+                return seq.Children;
+            if (node is YamlScalarNode)
+                return new[] { node };
+            throw Error(node, "expected a list");
+        }
+    }
+}
@@ -0,0 +1,186 @@
+﻿using System;
+using System.Collections.Concurrent;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Globalization;
+using System.IO;
+using System.Linq;
+using System.Text;
+using System.Threading.Tasks;
+using LevelPost;
+
+namespace LevelPostCli
+{
+    class LevelResult
+    {
+        public string file;
+        public double startMs, ms;
+        public ConvertStats stats;
+        public List<string> messages = new List<string>();
+        public string error;
+        public int Errors { get { return (error != null ? 1 : 0) + messages.Count(x => x.StartsWith("Error")); } }
+    }
+
+    class Program
+    {
+        static int Main(string[] args)
+        {
+            int jobs = 0;
+            string manifestFile = null, outFile = null, traceFile = null;
+            for (int i = 0; i < args.Length; i++)
+            {
+                if (args[i] == "-j" && i + 1 < args.Length && int.TryParse(args[i + 1], out jobs))
+                    i++;
+                else if (args[i] == "-o" && i + 1 < args.Length)
+                    outFile = args[++i];
+                else if (args[i] == "-t" && i + 1 < args.Length)
+                    traceFile = args[++i];
+                else if (manifestFile == null && !args[i].StartsWith("-"))
+                    manifestFile = args[i];
+                else
+                    manifestFile = null;
+            }
+            if (manifestFile == null)
+            {
+                Console.Error.WriteLine("Usage: LevelPostCli [-j jobs] [-o result.json] [-t trace.json] manifest.yaml");
+                return 2;
+            }
+
+            BatchManifest manifest;
+            try
+            {
+                manifest = BatchManifest.Load(manifestFile);
+            }
+            catch (Exception ex)
+            {
+                Console.Error.WriteLine("Error: cannot read " + manifestFile + ": " + ex.Message);
+                return 2;
+            }
+            if (jobs > 0)
+                manifest.jobs = jobs;
+            foreach (var dir in manifest.texDirs.Where(x => !Directory.Exists(x)))
+                Console.Error.WriteLine("Warning: ignoring non-existing directory " + dir);
+
+            if (traceFile != null)
+                Tracer.Start();
+            var results = RunBatch(manifest, out double totalMs);
+            if (traceFile != null)
+            {
+                Tracer.Stop();
+                Tracer.WriteChromeTrace(traceFile);
+                foreach (var line in Tracer.Summary())
+                    Console.Error.WriteLine(line);
+            }
+
+            var json = ToJson(manifest, results, totalMs);
+            if (outFile != null)
+                File.WriteAllText(outFile, json);
+            else
+                Console.Write(json);
+
+            return results.Any(x => x.Errors != 0) ? 1 : 0;
+        }
+
+        // Converts the levels with at most manifest.jobs at the same time. The bundle
+        // index and the texture cache are shared, so a texture or bundle used by
+        // several levels is only read once. Levels with the same bundle list share
+        // their name index.
+        static LevelResult[] RunBatch(BatchManifest manifest, out double totalMs)
+        {
+            var bundleFiles = new BundleFiles();
+            bundleFiles.Logger = msg => Console.Error.WriteLine(msg);
+            if (manifest.bundleIndex != null)
+                bundleFiles.LoadIndex(manifest.bundleIndex);
+
+            var nameIndexes = new ConcurrentDictionary<string, BundleIndex>(StringComparer.OrdinalIgnoreCase);
+            var results = manifest.levels.Select(x => new LevelResult() { file = x.file }).ToArray();
+            var total = Stopwatch.StartNew();
+            Parallel.For(0, results.Length, new ParallelOptions() { MaxDegreeOfParallelism = manifest.jobs }, i => {
+                var level = manifest.levels[i];
+                var result = results[i];
+                string name = Path.GetFileName(level.file);
+                Action<string> log = msg => {
+                    if (msg == null)
+                        return;
+                    lock (result.messages)
+                        result.messages.Add(msg);
+                    Console.Error.WriteLine(name + ": " + msg);
+                };
+                result.startMs = total.Elapsed.TotalMilliseconds;
+                var sw = Stopwatch.StartNew();
+                try
+                {
+                    var settings = manifest.CreateSettings();
+                    foreach (var path in level.bundles)
+                        settings.bundles.Add(ConvertBundle.FromInfo(path, bundleFiles.CachedBundleInfo(path)));
+                    settings.bundleIndex = nameIndexes.AddOrUpdate(string.Join("\n", level.bundles),
+                        _ => BundleIndex.Build(settings.bundles), (_, prev) => BundleIndex.Update(prev, settings.bundles));
+                    result.stats = LevelConvert.Convert(level.file, settings, log);
+                }
+                catch (Exception ex)
+                {
+                    result.error = ex.Message;
+                    log("Convert failed: " + ex.Message);
+                }
+                result.ms = sw.Elapsed.TotalMilliseconds;
+            });
+            totalMs = total.Elapsed.TotalMilliseconds;
+
+            if (manifest.bundleIndex != null)
+                bundleFiles.SaveIndex(manifest.bundleIndex);
+            return results;
+        }
+
+        static string ToJson(BatchManifest manifest, LevelResult[] results, double totalMs)
+        {
+            var sb = new StringBuilder();
+            sb.Append("{\n  \"jobs\": ").Append(manifest.jobs);
+            sb.Append(",\n  \"totalMs\": ").Append(Num(totalMs));
+            sb.Append(",\n  \"errors\": ").Append(results.Sum(x => x.Errors));
+            sb.Append(",\n  \"levels\": [");
+            for (int i = 0; i < results.Length; i++)
+            {
+                var r = results[i];
+                sb.Append(i == 0 ? "\n    {" : ",\n    {");
+                sb.Append("\"file\": ").Append(Str(r.file));
+                sb.Append(", \"ok\": ").Append(r.Errors == 0 ? "true" : "false");
+                sb.Append(", \"startMs\": ").Append(Num(r.startMs));
+                sb.Append(", \"ms\": ").Append(Num(r.ms));
+                if (r.stats != null)
+                    sb.Append(",\n     \"stats\": {").Append(string.Join(", ",
+                        typeof(ConvertStats).GetFields().Select(f => Str(f.Name) + ": " + f.GetValue(r.stats)))).Append("}");
+                if (r.error != null)
+                    sb.Append(",\n     \"error\": ").Append(Str(r.error));
+                sb.Append(",\n     \"messages\": [").Append(string.Join(", ", r.messages.Select(Str))).Append("]}");
+            }
+            sb.Append(results.Length == 0 ? "]\n}\n" : "\n  ]\n}\n");
+            return sb.ToString();
+        }
+
+        static string Num(double x)
+        {
+            return Math.Round(x, 1).ToString(CultureInfo.InvariantCulture);
+        }
+
+        static string Str(string s)
+        {
+            var sb = new StringBuilder("\"");
+            foreach (char c in s)
+                switch (c)
+                {
+                    case '"': sb.Append("\\\""); break;
+                    case '\\': sb.Append("\\\\"); break;
+                    case '\n': sb.Append("\\n"); break;
+                    case '\r': sb.Append("\\r"); break;
+                    case '\t': sb.Append("\\t"); break;
+                    default:
+                        if (c < ' ')
+                            sb.Append("\\u").Append(((int)c).ToString("x4"));
+                        else
+                            sb.Append(c);
+                        break;
+                }
+            return sb.Append('"').ToString();
+        }
+    }
+}
@@ -1,22 +1,35 @@
-#include <windows.h>
+#include <stddef.h>
+#ifndef _WIN32
+#include <stdlib.h>
+#endif
 
-#include "../../../../c/LzmaDec.h"
-#define UNUSED_VAR(x) (void)(x)
+#include "native.h"
+#include "trace.h"
+#include "LzmaDec.h"
 
 static void *myalloc(ISzAllocPtr arg, SizeT size) {
 	UNUSED_VAR(arg);
+#ifdef _WIN32
 	return HeapAlloc(GetProcessHeap(), 0, size);
+#else
+	return malloc(size);
+#endif
 }
 
 static void myfree(ISzAllocPtr arg, void *p) {
 	UNUSED_VAR(arg);
+#ifdef _WIN32
 	HeapFree(GetProcessHeap(), 0, p);
+#else
+	free(p);
+#endif
 }
 
-__declspec(dllexport) SRes __stdcall mydec(Byte *dest, SizeT destlen,
+static const ISzAlloc alloc = {myalloc, myfree};
+
+LPEXPORT SRes LPCALL mydec(Byte *dest, SizeT destlen,
 	const Byte *src, SizeT srclen) {
 	ELzmaStatus status;
-	ISzAlloc alloc = {myalloc, myfree};
 	if (srclen < 5)
 		return SZ_ERROR_INPUT_EOF;
 	srclen -= 5;
@@ -24,3 +37,112 @@ __declspec(dllexport) SRes __stdcall mydec(Byte *dest, SizeT destlen,
 			src + 5, &srclen,
 			src, 5, LZMA_FINISH_END, &status, &alloc);
 }
+
+// Reusable decoder, keeps the probability tables allocated between blocks.
+// The output buffer is used as dictionary, like LzmaDecode.
+typedef struct {
+	CLzmaDec dec;
+} decoder;
+
+LPEXPORT decoder *LPCALL decoder_create(void) {
+	decoder *d;
+	if (!(d = myalloc(&alloc, sizeof(*d))))
+		return NULL;
+	LzmaDec_Construct(&d->dec);
+	return d;
+}
+
+LPEXPORT SRes LPCALL decoder_decode(decoder *d, Byte *dest, SizeT destlen,
+	const Byte *src, SizeT srclen) {
+	ELzmaStatus status;
+	SRes res;
+	TRACE_BEGIN(t);
+	if (srclen < LZMA_PROPS_SIZE)
+		return SZ_ERROR_INPUT_EOF;
+	// only reallocates when lc + lp differ from the previous block
+	if ((res = LzmaDec_AllocateProbs(&d->dec, src, LZMA_PROPS_SIZE, &alloc)) != SZ_OK)
+		return res;
+	srclen -= LZMA_PROPS_SIZE;
+	d->dec.dic = dest;
+	d->dec.dicBufSize = destlen;
+	LzmaDec_Init(&d->dec);
+	res = LzmaDec_DecodeToDic(&d->dec, destlen, src + LZMA_PROPS_SIZE, &srclen,
+		LZMA_FINISH_END, &status);
+	if (res == SZ_OK && status == LZMA_STATUS_NEEDS_MORE_INPUT)
+		res = SZ_ERROR_INPUT_EOF;
+	d->dec.dic = NULL;
+	TRACE_END(t, TRACE_LZMA, srclen + LZMA_PROPS_SIZE, destlen);
+	return res;
+}
+
+LPEXPORT void LPCALL decoder_destroy(decoder *d) {
+	if (d == NULL)
+		return;
+	LzmaDec_FreeProbs(&d->dec, &alloc);
+	myfree(&alloc, d);
+}
+
+// Incremental decoding: mydec_init, mydec_feed until done, mydec_finish.
+// The window is the LZMA dictionary buffer. It must either hold the whole
+// output or be at least the dictionary size from the props. When window is
+// NULL a window of the dictionary size is allocated.
+typedef struct {
+	CLzmaDec dec;
+	int ownWindow;
+} mydec_stream;
+
+LPEXPORT mydec_stream *LPCALL mydec_init(const Byte *props, SizeT propslen,
+	Byte *window, SizeT windowlen) {
+	mydec_stream *s;
+	if (propslen < LZMA_PROPS_SIZE)
+		return NULL;
+	if (!(s = myalloc(&alloc, sizeof(*s))))
+		return NULL;
+	LzmaDec_Construct(&s->dec);
+	s->ownWindow = window == NULL;
+	if ((s->ownWindow ?
+		LzmaDec_Allocate(&s->dec, props, LZMA_PROPS_SIZE, &alloc) :
+		LzmaDec_AllocateProbs(&s->dec, props, LZMA_PROPS_SIZE, &alloc)) != SZ_OK) {
+		myfree(&alloc, s);
+		return NULL;
+	}
+	if (!s->ownWindow) {
+		s->dec.dic = window;
+		s->dec.dicBufSize = windowlen;
+	}
+	LzmaDec_Init(&s->dec);
+	return s;
+}
+
+// Decodes as much of src as possible. With dest NULL the output is left in
+// the window (at most up to its end, no wrap around) and *destlen is set to
+// the number of bytes added to it, otherwise the output is copied to dest
+// like LzmaDec_DecodeToBuf. *srclen is set to the number of bytes consumed.
+LPEXPORT SRes LPCALL mydec_feed(mydec_stream *s, Byte *dest, SizeT *destlen,
+	const Byte *src, SizeT *srclen, int finish, int *status) {
+	ELzmaStatus st;
+	SRes res;
+	TRACE_BEGIN(t);
+	if (dest == NULL) {
+		SizeT start = s->dec.dicPos;
+		res = LzmaDec_DecodeToDic(&s->dec, s->dec.dicBufSize, src, srclen,
+			finish ? LZMA_FINISH_END : LZMA_FINISH_ANY, &st);
+		*destlen = s->dec.dicPos - start;
+	} else
+		res = LzmaDec_DecodeToBuf(&s->dec, dest, destlen, src, srclen,
+			finish ? LZMA_FINISH_END : LZMA_FINISH_ANY, &st);
+	if (status)
+		*status = st;
+	TRACE_END(t, TRACE_LZMA, *srclen, *destlen);
+	return res;
+}
+
+LPEXPORT void LPCALL mydec_finish(mydec_stream *s) {
+	if (s == NULL)
+		return;
+	if (s->ownWindow)
+		LzmaDec_Free(&s->dec, &alloc);
+	else
+		LzmaDec_FreeProbs(&s->dec, &alloc);
+	myfree(&alloc, s);
+}
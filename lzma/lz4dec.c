@@ -0,0 +1,101 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "native.h"
+#include "trace.h"
+
+// LZ4 block decoder for the bundle blocks (raw blocks, no frame header).
+// Literals and far matches are copied 16 bytes at a time like memcpy.c, as
+// long as the buffers have room for the overrun.
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define COPY16(d, s) _mm_storeu_si128((__m128i *)(d), _mm_loadu_si128((const __m128i *)(s)))
+#else
+#define COPY16(d, s) memcpy((d), (s), 16)
+#endif
+
+// copies len bytes, may write up to 15 bytes past d + len
+static void wildcopy(unsigned char *d, const unsigned char *s, size_t len) {
+	unsigned char *e = d + len;
+	do {
+		COPY16(d, s);
+		d += 16;
+		s += 16;
+	} while (d < e);
+}
+
+static int decode_block(unsigned char *dst, int dstlen,
+	const unsigned char *src, int srclen) {
+	const unsigned char *ip = src, *iend = src + srclen;
+	unsigned char *op = dst, *oend = dst + dstlen;
+	if (dstlen < 0 || srclen < 0)
+		return -1;
+	for (;;) {
+		unsigned token, b;
+		size_t len, ofs;
+		const unsigned char *match;
+
+		if (ip >= iend)
+			return -1;
+		token = *ip++;
+		if ((len = token >> 4) == 15)
+			do {
+				if (ip >= iend)
+					return -1;
+				len += b = *ip++;
+				if (len > (size_t)dstlen)
+					return -1;
+			} while (b == 255);
+		if ((size_t)(iend - ip) < len || (size_t)(oend - op) < len)
+			return -1;
+		if ((size_t)(iend - ip) >= len + 16 && (size_t)(oend - op) >= len + 16)
+			wildcopy(op, ip, len);
+		else
+			memcpy(op, ip, len);
+		op += len;
+		ip += len;
+		if (ip == iend) // last sequence has only literals
+			break;
+
+		if (iend - ip < 2)
+			return -1;
+		ofs = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (ofs == 0 || ofs > (size_t)(op - dst))
+			return -1;
+		match = op - ofs;
+		if ((len = token & 15) == 15)
+			do {
+				if (ip >= iend)
+					return -1;
+				len += b = *ip++;
+				if (len > (size_t)dstlen)
+					return -1;
+			} while (b == 255);
+		len += 4;
+		if ((size_t)(oend - op) < len)
+			return -1;
+		if (ofs >= 16 && (size_t)(oend - op) >= len + 16) {
+			wildcopy(op, match, len);
+			op += len;
+		} else {
+			// overlapping copy repeats the last ofs bytes
+			unsigned char *e = op + len;
+			while (op < e)
+				*op++ = *match++;
+		}
+	}
+	return (int)(op - dst);
+}
+
+// Returns the number of bytes written to dst, or -1 for malformed input or
+// when the output does not fit in dstlen.
+LPEXPORT int LPCALL lz4_decode_block(unsigned char *dst, int dstlen,
+	const unsigned char *src, int srclen) {
+	int ret;
+	TRACE_BEGIN(t);
+	ret = decode_block(dst, dstlen, src, srclen);
+	TRACE_END(t, TRACE_LZ4, srclen, ret < 0 ? 0 : ret);
+	return ret;
+}
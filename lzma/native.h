@@ -0,0 +1,15 @@
+#ifndef NATIVE_H
+#define NATIVE_H
+
+#ifdef _WIN32
+#include <windows.h>
+#define LPEXPORT __declspec(dllexport)
+#define LPCALL __stdcall
+#else
+#define LPEXPORT __attribute__((visibility("default")))
+#define LPCALL
+#endif
+
+#define UNUSED_VAR(x) (void)(x)
+
+#endif
@@ -0,0 +1,239 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "native.h"
+
+// Pixel conversion for converted textures. A 32 bpp bitmap locked by
+// System.Drawing has BGRA pixels with the top row first, the level wants RGBA
+// with the bottom row first. Uses SSE2, or AVX2 when the cpu has it.
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define X86
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HAVE_SSE2
+#endif
+
+#if defined(X86) && (defined(_MSC_VER) || defined(__GNUC__))
+#include <immintrin.h>
+#define HAVE_AVX2
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#include <cpuid.h>
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+// BGRA -> RGBA on a little endian 32 bit pixel
+#define SWAP_RB(x) (((x) & 0xff00ff00u) | (((x) >> 16) & 0xffu) | (((x) & 0xffu) << 16))
+
+#ifndef HAVE_SSE2
+static unsigned rows_scalar(unsigned char *dst, const unsigned char *src, int width, int height, ptrdiff_t stride) {
+	unsigned all = 0xffffffffu;
+	int x, y;
+	for (y = height - 1; y >= 0; y--) {
+		const unsigned char *s = src + y * stride;
+		for (x = 0; x < width; x++) {
+			unsigned p;
+			memcpy(&p, s + x * 4, 4);
+			all &= p;
+			p = SWAP_RB(p);
+			memcpy(dst, &p, 4);
+			dst += 4;
+		}
+	}
+	return all;
+}
+#endif
+
+#ifdef HAVE_SSE2
+static unsigned rows_sse2(unsigned char *dst, const unsigned char *src, int width, int height, ptrdiff_t stride) {
+	const __m128i ag = _mm_set1_epi32((int)0xff00ff00), rb = _mm_set1_epi32(0x00ff00ff);
+	__m128i all = _mm_set1_epi32(-1);
+	unsigned tail = 0xffffffffu, ret;
+	int x, y, n = width & ~3;
+	for (y = height - 1; y >= 0; y--) {
+		const unsigned char *s = src + y * stride;
+		for (x = 0; x < n; x += 4) {
+			__m128i p = _mm_loadu_si128((const __m128i *)(s + x * 4)), c = _mm_and_si128(p, rb);
+			all = _mm_and_si128(all, p);
+			p = _mm_or_si128(_mm_and_si128(p, ag), _mm_or_si128(_mm_slli_epi32(c, 16), _mm_srli_epi32(c, 16)));
+			_mm_storeu_si128((__m128i *)dst, p);
+			dst += 16;
+		}
+		for (; x < width; x++) {
+			unsigned p;
+			memcpy(&p, s + x * 4, 4);
+			tail &= p;
+			p = SWAP_RB(p);
+			memcpy(dst, &p, 4);
+			dst += 4;
+		}
+	}
+	all = _mm_and_si128(all, _mm_shuffle_epi32(all, _MM_SHUFFLE(1, 0, 3, 2)));
+	all = _mm_and_si128(all, _mm_shuffle_epi32(all, _MM_SHUFFLE(2, 3, 0, 1)));
+	ret = (unsigned)_mm_cvtsi128_si32(all);
+	return ret & tail;
+}
+#endif
+
+#ifdef HAVE_AVX2
+static int avx2_checked, avx2_ok;
+
+static int has_avx2(void) {
+	if (!avx2_checked) {
+		int ok = 0;
+#ifdef _MSC_VER
+		int r[4];
+		__cpuid(r, 0);
+		if (r[0] >= 7) {
+			__cpuid(r, 1);
+			if ((r[2] & (1 << 27)) && (r[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6) {
+				__cpuidex(r, 7, 0);
+				ok = (r[1] & (1 << 5)) != 0;
+			}
+		}
+#else
+		unsigned a, b, c, d;
+		if (__get_cpuid_max(0, 0) >= 7) {
+			__cpuid(1, a, b, c, d);
+			if ((c & (1u << 27)) && (c & (1u << 28))) {
+				unsigned lo, hi;
+				__asm__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+				if ((lo & 6) == 6) {
+					__cpuid_count(7, 0, a, b, c, d);
+					ok = (b & (1u << 5)) != 0;
+				}
+			}
+		}
+#endif
+		avx2_ok = ok;
+		avx2_checked = 1;
+	}
+	return avx2_ok;
+}
+
+TARGET_AVX2
+static unsigned rows_avx2(unsigned char *dst, const unsigned char *src, int width, int height, ptrdiff_t stride) {
+	const __m256i shuf = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+		2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+	__m256i all = _mm256_set1_epi32(-1);
+	__m128i all4;
+	unsigned tail = 0xffffffffu, ret;
+	int x, y, n = width & ~7;
+	for (y = height - 1; y >= 0; y--) {
+		const unsigned char *s = src + y * stride;
+		for (x = 0; x < n; x += 8) {
+			__m256i p = _mm256_loadu_si256((const __m256i *)(s + x * 4));
+			all = _mm256_and_si256(all, p);
+			_mm256_storeu_si256((__m256i *)dst, _mm256_shuffle_epi8(p, shuf));
+			dst += 32;
+		}
+		for (; x < width; x++) {
+			unsigned p;
+			memcpy(&p, s + x * 4, 4);
+			tail &= p;
+			p = SWAP_RB(p);
+			memcpy(dst, &p, 4);
+			dst += 4;
+		}
+	}
+	all4 = _mm_and_si128(_mm256_castsi256_si128(all), _mm256_extracti128_si256(all, 1));
+	all4 = _mm_and_si128(all4, _mm_shuffle_epi32(all4, _MM_SHUFFLE(1, 0, 3, 2)));
+	all4 = _mm_and_si128(all4, _mm_shuffle_epi32(all4, _MM_SHUFFLE(2, 3, 0, 1)));
+	ret = (unsigned)_mm_cvtsi128_si32(all4);
+	return ret & tail;
+}
+
+// 4 RGBA pixels -> 12 RGB bytes, stores 16 bytes
+TARGET_AVX2
+static void pack_rgb_avx2(unsigned char *dst, const unsigned char *src, int pixels) {
+	const __m128i shuf = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	int i;
+	for (i = 0; i + 5 < pixels; i += 4) // keep the 16 byte store inside dst
+		_mm_storeu_si128((__m128i *)(dst + i * 3), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i * 4)), shuf));
+	for (; i < pixels; i++) {
+		dst[i * 3 + 0] = src[i * 4 + 0];
+		dst[i * 3 + 1] = src[i * 4 + 1];
+		dst[i * 3 + 2] = src[i * 4 + 2];
+	}
+}
+
+// 12 RGB bytes -> 4 RGBA pixels with alpha 255, loads 16 bytes
+TARGET_AVX2
+static void unpack_rgb_avx2(unsigned char *dst, const unsigned char *src, int pixels) {
+	const __m128i shuf = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+	int i;
+	for (i = 0; i + 5 < pixels; i += 4) // keep the 16 byte load inside src
+		_mm_storeu_si128((__m128i *)(dst + i * 4),
+			_mm_or_si128(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i * 3)), shuf), alpha));
+	for (; i < pixels; i++) {
+		dst[i * 4 + 0] = src[i * 3 + 0];
+		dst[i * 4 + 1] = src[i * 3 + 1];
+		dst[i * 4 + 2] = src[i * 3 + 2];
+		dst[i * 4 + 3] = 255;
+	}
+}
+#endif
+
+// Converts the BGRA rows at scan0 (row y at scan0 + y * stride, stride may be
+// negative) to packed RGBA in dst, bottom row first. dst must hold
+// width * height * 4 bytes. Returns 1 if any pixel has alpha != 255, 0 if not,
+// -1 for invalid arguments.
+LPEXPORT int LPCALL tex_bgra_to_rgba(unsigned char *dst, const unsigned char *scan0, int stride,
+	int width, int height) {
+	unsigned all;
+	if (width < 0 || height < 0 || (stride < 0 ? -(ptrdiff_t)stride : stride) < (ptrdiff_t)width * 4)
+		return -1;
+	if (!width || !height)
+		return 0;
+#ifdef HAVE_AVX2
+	if (has_avx2())
+		all = rows_avx2(dst, scan0, width, height, stride);
+	else
+#endif
+#ifdef HAVE_SSE2
+		all = rows_sse2(dst, scan0, width, height, stride);
+#else
+		all = rows_scalar(dst, scan0, width, height, stride);
+#endif
+	return (all >> 24) != 0xff;
+}
+
+// Drops the alpha bytes of RGBA pixels. dst may be the same buffer as src.
+LPEXPORT void LPCALL tex_rgba_to_rgb(unsigned char *dst, const unsigned char *src, int pixels) {
+	int i;
+#ifdef HAVE_AVX2
+	if (has_avx2()) {
+		pack_rgb_avx2(dst, src, pixels);
+		return;
+	}
+#endif
+	for (i = 0; i < pixels; i++) {
+		dst[i * 3 + 0] = src[i * 4 + 0];
+		dst[i * 3 + 1] = src[i * 4 + 1];
+		dst[i * 3 + 2] = src[i * 4 + 2];
+	}
+}
+
+// Expands RGB pixels to RGBA with alpha 255. dst must not overlap src.
+LPEXPORT void LPCALL tex_rgb_to_rgba(unsigned char *dst, const unsigned char *src, int pixels) {
+	int i;
+#ifdef HAVE_AVX2
+	if (has_avx2()) {
+		unpack_rgb_avx2(dst, src, pixels);
+		return;
+	}
+#endif
+	for (i = 0; i < pixels; i++) {
+		dst[i * 4 + 0] = src[i * 3 + 0];
+		dst[i * 4 + 1] = src[i * 3 + 1];
+		dst[i * 4 + 2] = src[i * 3 + 2];
+		dst[i * 4 + 3] = 255;
+	}
+}
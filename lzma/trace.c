@@ -0,0 +1,28 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 199309L
+#include <time.h>
+#endif
+
+#include "trace.h"
+
+trace_callback volatile trace_cb;
+
+LPEXPORT void LPCALL native_trace_set(trace_callback cb) {
+	trace_cb = cb;
+}
+
+// monotonic time in nanoseconds
+long long trace_now(void) {
+#ifdef _WIN32
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+	if (!freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (long long)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
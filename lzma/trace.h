@@ -0,0 +1,29 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "native.h"
+
+// Decode timings for the managed tracer (Tracer.cs). It sets a callback with
+// native_trace_set while tracing, which is called after each decode with the
+// time taken and the compressed and decompressed sizes. Compiled out with
+// NO_TRACE, for the standalone images built by mkdll.bat.
+
+enum { TRACE_LZMA = 0, TRACE_LZ4 = 1 };
+
+typedef void (LPCALL *trace_callback)(int id, long long ns, long long in, long long out);
+
+#ifdef NO_TRACE
+#define TRACE_BEGIN(t)
+#define TRACE_END(t, id, in, out)
+#else
+extern trace_callback volatile trace_cb;
+long long trace_now(void);
+#define TRACE_BEGIN(t) long long t = trace_cb ? trace_now() : 0
+#define TRACE_END(t, id, in, out) do { \
+		trace_callback cb_ = trace_cb; \
+		if (cb_ && t) \
+			cb_(id, trace_now() - t, (long long)(in), (long long)(out)); \
+	} while (0)
+#endif
+
+#endif